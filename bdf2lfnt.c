@@ -0,0 +1,296 @@
+/* Convert a BDF bitmap font into a font file for loki_font_load().
+
+    bdf2lfnt font.bdf font.lfnt
+
+   The glyphs are packed into rows of an atlas, each starting on a byte
+   boundary so that they can be drawn 8 pixels at a time.  Characters
+   past 0xFFFF are left out, and blank glyphs take no space in the atlas.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ATLAS_WIDTH 256
+#define MAX_GLYPHS  65535
+
+typedef struct {
+    unsigned int ch;
+    int x, y;
+    int w, h;
+    int xoff, yoff;     /* yoff is from the bottom, as BDF has it */
+    int advance;
+    unsigned char *bits;    /* (w+7)/8 bytes per row */
+} glyph;
+
+static glyph glyphs[MAX_GLYPHS];
+static int nglyphs = 0;
+
+static void put16(unsigned char *p, unsigned int value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static void put32(unsigned char *p, unsigned int value)
+{
+    put16(p, value & 0xFFFF);
+    put16(p + 2, value >> 16);
+}
+
+static int hexval(int c)
+{
+    if ( (c >= '0') && (c <= '9') ) {
+        return c - '0';
+    }
+    if ( (c >= 'A') && (c <= 'F') ) {
+        return c - 'A' + 10;
+    }
+    if ( (c >= 'a') && (c <= 'f') ) {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/* Read the rows of a glyph bitmap, returns 0 if the glyph is blank */
+static int read_bitmap(FILE *fp, glyph *g)
+{
+    char line[1024];
+    int pitch, row, i, hi, lo, blank;
+
+    pitch = (g->w + 7) / 8;
+    g->bits = (unsigned char *)calloc(pitch * g->h + 1, 1);
+    if ( ! g->bits ) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    blank = 1;
+    for ( row = 0; row < g->h; ++row ) {
+        if ( ! fgets(line, sizeof(line), fp) ) {
+            return 0;
+        }
+        for ( i = 0; i < pitch; ++i ) {
+            hi = hexval(line[i*2]);
+            lo = (hi < 0) ? -1 : hexval(line[i*2+1]);
+            if ( lo < 0 ) {
+                break;
+            }
+            g->bits[row * pitch + i] = (hi << 4) | lo;
+        }
+        /* Clear anything past the right edge of the glyph */
+        if ( g->w % 8 ) {
+            g->bits[row * pitch + pitch - 1] &= 0xFF << (8 - g->w % 8);
+        }
+        for ( i = 0; i < pitch; ++i ) {
+            if ( g->bits[row * pitch + i] ) {
+                blank = 0;
+            }
+        }
+    }
+    return ! blank;
+}
+
+static int find_glyph(unsigned int ch)
+{
+    int i;
+
+    for ( i = 0; i < nglyphs; ++i ) {
+        if ( glyphs[i].ch == ch ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int main(int argc, char *argv[])
+{
+    FILE *fp;
+    char line[1024];
+    glyph *g;
+    unsigned char header[16], record[16], *atlas;
+    int ascent, descent, default_char, bbh, bbyoff;
+    int encoding, dwidth, w, h, xoff, yoff;
+    int atlas_w, atlas_h, pitch, x, y, rowh;
+    int i, row, missing;
+
+    if ( argc != 3 ) {
+        fprintf(stderr, "Usage: %s font.bdf font.lfnt\n", argv[0]);
+        return 1;
+    }
+    fp = fopen(argv[1], "r");
+    if ( ! fp ) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    ascent = descent = -1;
+    default_char = -1;
+    bbh = bbyoff = 0;
+    encoding = -1;
+    dwidth = w = h = xoff = yoff = 0;
+    while ( fgets(line, sizeof(line), fp) ) {
+        if ( sscanf(line, "FONTBOUNDINGBOX %*d %d %*d %d",
+                    &bbh, &bbyoff) == 2 ) {
+            continue;
+        }
+        if ( sscanf(line, "FONT_ASCENT %d", &ascent) == 1 ) {
+            continue;
+        }
+        if ( sscanf(line, "FONT_DESCENT %d", &descent) == 1 ) {
+            continue;
+        }
+        if ( sscanf(line, "DEFAULT_CHAR %d", &default_char) == 1 ) {
+            continue;
+        }
+        if ( strncmp(line, "STARTCHAR", 9) == 0 ) {
+            encoding = -1;
+            dwidth = w = h = xoff = yoff = 0;
+            continue;
+        }
+        if ( sscanf(line, "ENCODING %d", &encoding) == 1 ) {
+            continue;
+        }
+        if ( sscanf(line, "DWIDTH %d", &dwidth) == 1 ) {
+            continue;
+        }
+        if ( sscanf(line, "BBX %d %d %d %d", &w, &h, &xoff, &yoff) == 4 ) {
+            continue;
+        }
+        if ( strncmp(line, "BITMAP", 6) != 0 ) {
+            continue;
+        }
+
+        /* Keep the glyphs that can be stored */
+        if ( (encoding < 0) || (encoding > 0xFFFF) ||
+             (w < 0) || (w > 255) || (h < 0) || (h > 255) ||
+             (dwidth < 0) || (dwidth > 255) ||
+             (xoff < -128) || (xoff > 127) ) {
+            if ( encoding >= 0 ) {
+                fprintf(stderr, "Skipping character %d\n", encoding);
+            }
+            continue;
+        }
+        if ( nglyphs == MAX_GLYPHS ) {
+            fprintf(stderr, "Too many characters\n");
+            break;
+        }
+        g = &glyphs[nglyphs++];
+        g->ch = encoding;
+        g->w = w;
+        g->h = h;
+        g->xoff = xoff;
+        g->yoff = yoff;
+        g->advance = dwidth;
+        if ( ! read_bitmap(fp, g) ) {
+            g->w = 0;
+            g->h = 0;
+        }
+    }
+    fclose(fp);
+
+    if ( nglyphs == 0 ) {
+        fprintf(stderr, "%s has no characters\n", argv[1]);
+        return 1;
+    }
+    if ( ascent < 0 ) {
+        ascent = bbh + bbyoff;
+    }
+    if ( descent < 0 ) {
+        descent = -bbyoff;
+    }
+    for ( i = 0; i < nglyphs; ++i ) {
+        g = &glyphs[i];
+        y = ascent - (g->yoff + g->h);
+        if ( (y < -128) || (y > 127) ) {
+            fprintf(stderr, "Character %u is too far from the baseline\n", g->ch);
+            g->w = 0;
+            g->h = 0;
+        }
+    }
+
+    /* Pack the glyphs into rows */
+    atlas_w = ATLAS_WIDTH;
+    for ( i = 0; i < nglyphs; ++i ) {
+        if ( glyphs[i].w > atlas_w ) {
+            atlas_w = (glyphs[i].w + 7) & ~7;
+        }
+    }
+    x = y = rowh = 0;
+    for ( i = 0; i < nglyphs; ++i ) {
+        g = &glyphs[i];
+        if ( x + g->w > atlas_w ) {
+            x = 0;
+            y += rowh;
+            rowh = 0;
+        }
+        g->x = x;
+        g->y = y;
+        x += (g->w + 7) & ~7;
+        if ( g->h > rowh ) {
+            rowh = g->h;
+        }
+    }
+    atlas_h = y + rowh;
+    if ( atlas_h > 0xFFFF ) {
+        fprintf(stderr, "The font is too big\n");
+        return 1;
+    }
+    pitch = atlas_w / 8;
+    atlas = (unsigned char *)calloc(pitch * atlas_h + 1, 1);
+    if ( ! atlas ) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for ( i = 0; i < nglyphs; ++i ) {
+        g = &glyphs[i];
+        for ( row = 0; row < g->h; ++row ) {
+            memcpy(atlas + (g->y + row) * pitch + g->x / 8,
+                   g->bits + row * ((g->w + 7) / 8), (g->w + 7) / 8);
+        }
+    }
+
+    missing = find_glyph(default_char);
+    if ( missing < 0 ) {
+        missing = find_glyph('?');
+    }
+    if ( missing < 0 ) {
+        missing = find_glyph(' ');
+    }
+    if ( missing < 0 ) {
+        missing = 0;
+    }
+
+    fp = fopen(argv[2], "wb");
+    if ( ! fp ) {
+        perror(argv[2]);
+        return 1;
+    }
+    memcpy(header, "LFNT", 4);
+    put16(header + 4, 1);
+    put16(header + 6, nglyphs);
+    put16(header + 8, ascent + descent);
+    put16(header + 10, missing);
+    put16(header + 12, atlas_w);
+    put16(header + 14, atlas_h);
+    fwrite(header, sizeof(header), 1, fp);
+    for ( i = 0; i < nglyphs; ++i ) {
+        g = &glyphs[i];
+        memset(record, 0, sizeof(record));
+        put32(record, g->ch);
+        put16(record + 4, g->x);
+        put16(record + 6, g->y);
+        record[8] = g->w;
+        record[9] = g->h;
+        record[10] = (signed char)g->xoff;
+        /* Measured down from the top of the line */
+        record[11] = (signed char)(ascent - (g->yoff + g->h));
+        record[12] = g->advance;
+        fwrite(record, sizeof(record), 1, fp);
+    }
+    fwrite(atlas, pitch * atlas_h, 1, fp);
+    if ( fclose(fp) != 0 ) {
+        perror(argv[2]);
+        return 1;
+    }
+    return 0;
+}
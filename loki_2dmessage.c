@@ -26,16 +26,98 @@
 #include <ctype.h>
 #include <unistd.h>
 #include "loki_2dmessage.h"
+#include "loki_font.h"
 #include "SDL.h"
 
 #ifdef STANDALONE
 #include "sdl_utils.h"
 #endif
 
-extern unsigned char loki_fontchars[][8];
-
 static int texty = 0;
 
+/*
+ * The parts of the screen that have been drawn on, but not updated yet.
+ *  If the list fills up, it is replaced by a single rectangle covering
+ *  all of them.
+ */
+#define MAX_DIRTY_RECTS 32
+
+static SDL_Rect dirty_rects[MAX_DIRTY_RECTS];
+static int dirty_count = 0;
+static int dirty_queued = 0;
+
+static void loki_2dmsg_internal_addDirty(SDL_Surface *surface,
+                                         int x, int y, int w, int h)
+{
+    SDL_Rect *rect;
+    int x2, y2;
+    int i;
+
+    /* Clip to the surface, SDL_UpdateRects() doesn't. */
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > surface->w) w = surface->w - x;
+    if (y + h > surface->h) h = surface->h - y;
+    if ((w <= 0) || (h <= 0))
+        return;
+
+    for (i = 0; i < dirty_count; i++)
+    {
+        rect = &dirty_rects[i];
+        if ((x >= rect->x) && (y >= rect->y) &&
+            (x + w <= rect->x + rect->w) && (y + h <= rect->y + rect->h))
+            return;  /* already covered. */
+    } // for
+
+    if (dirty_count == MAX_DIRTY_RECTS)
+    {
+        x2 = x + w;
+        y2 = y + h;
+        for (i = 0; i < dirty_count; i++)
+        {
+            rect = &dirty_rects[i];
+            if (rect->x < x) x = rect->x;
+            if (rect->y < y) y = rect->y;
+            if (rect->x + rect->w > x2) x2 = rect->x + rect->w;
+            if (rect->y + rect->h > y2) y2 = rect->y + rect->h;
+        } // for
+        w = x2 - x;
+        h = y2 - y;
+        dirty_count = 0;
+    } // if
+
+    rect = &dirty_rects[dirty_count++];
+    rect->x = x;
+    rect->y = y;
+    rect->w = w;
+    rect->h = h;
+}
+
+
+/*
+ * Hold back the screen updates from loki_2dmsg_print() until
+ *  loki_2dmsg_update() is called, so a message of many lines is sent
+ *  to the screen in one go.
+ */
+void loki_2dmsg_queue(void)
+{
+    dirty_queued = 1;
+}
+
+
+/*
+ * Update the parts of the screen that have been drawn on.
+ */
+void loki_2dmsg_update(void)
+{
+    SDL_Surface *surface = SDL_GetVideoSurface();
+
+    dirty_queued = 0;
+    if ((surface != NULL) && (dirty_count > 0))
+        SDL_UpdateRects(surface, dirty_count, dirty_rects);
+    dirty_count = 0;
+}
+
 /*
  *
  *  returns -1 on error, 0 on success.
@@ -47,94 +129,404 @@ int loki_2dmsg_initialize(float bgr, float bgg, float bgb)
     texty = 0;
 
     SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0, 0, 0));
+    dirty_count = 0;
+    loki_2dmsg_internal_addDirty(surface, 0, 0, surface->w, surface->h);
 
     return(0);
 }
 
 
-static inline void loki_2dmsg_internal_printChar(int x, int y,
-                                                 SDL_Surface *surface,
-                                                 unsigned char ch,
-                                                 Uint32 color)
+/*
+ * A row of a glyph is 8 pixels, which is 8 to 32 bytes, or 1 to 4 64-bit
+ *  words.  For each of the 256 possible rows of font bits, the mask has
+ *  the bytes of the set pixels filled in, so a whole row is drawn with a
+ *  few masked stores instead of testing each bit.  The masks only depend
+ *  on the bytes per pixel, and are rebuilt when that changes.
+ */
+static Uint64 glyph_masks[256][4];
+static int glyph_bpp = 0;
+
+static void loki_2dmsg_internal_expandFont(int bpp)
 {
-    int bpp;
-    int i;
+    Uint8 row[32];
+    int bits;
     int j;
-    unsigned char *dest;
-    unsigned char *src;
 
-    if (ch > 127)
+    if (bpp == glyph_bpp)
         return;
 
-    bpp = surface->format->BytesPerPixel;
+    memset(row, 0, sizeof (row));
+    for (bits = 0; bits < 256; bits++)
+    {
+        /* bit 7 is the leftmost pixel. */
+        for (j = 0; j < 8; j++)
+            memset(row + (j * bpp), (bits & (0x80 >> j)) ? 0xFF : 0x00, bpp);
+        memcpy(glyph_masks[bits], row, sizeof (row));
+    } // for
 
-    src = loki_fontchars[ch];
+    glyph_bpp = bpp;
+}
+
+
+/*
+ * Fill a row of 8 pixels with the color, laid out as it is in memory.
+ */
+static void loki_2dmsg_internal_expandColor(Uint64 *pattern, int bpp,
+                                            Uint32 color)
+{
+    Uint8 row[32];
+    Uint8 *dest = row;
+    Uint16 color16 = (Uint16) color;
+    int j;
 
-    for (i = 7; i >= 0; i--)
+    memset(row, 0, sizeof (row));
+    for (j = 0; j < 8; j++, dest += bpp)
     {
-        dest = surface->pixels + ((surface->pitch * y) + (x * bpp));
+        switch(bpp) {
+            case 1:
+                *dest = (Uint8) color;
+                break;
+            case 2:
+                memcpy(dest, &color16, 2);
+                break;
+            case 3:
+                #if SDL_BYTEORDER == SDL_LIL_ENDIAN
+                    dest[0] = color & 0xFF;
+                    dest[1] = (color >> 8) & 0xFF;
+                    dest[2] = (color >> 16) & 0xFF;
+                #else
+                    dest[0] = (color >> 16) & 0xFF;
+                    dest[1] = (color >> 8) & 0xFF;
+                    dest[2] = color & 0xFF;
+                #endif
+                break;
+            case 4:
+                memcpy(dest, &color, 4);
+                break;
+        }
+    } // for
+
+    memcpy(pattern, row, sizeof (row));
+}
+
+
+/*
+ * Draw a glyph 8 pixels at a time, 'bytes' is the number of bytes of font
+ *  bits in each row.  'words' is the bytes per pixel, and is always a
+ *  constant so each pixel size gets its own unrolled copy of the loop.
+ *  Only the bytes of the glyph's own pixels are changed, even at 24 bits.
+ */
+static inline void loki_2dmsg_internal_printGlyph(Uint8 *dest, int pitch,
+                                                  const Uint8 *bits,
+                                                  int bitpitch, int bytes,
+                                                  int rows,
+                                                  const Uint64 *pattern,
+                                                  const int words)
+{
+    const Uint64 *mask;
+    Uint64 pixels;
+    Uint8 *d;
+    int i;
+    int c;
+    int k;
 
-        for (j = 128; j > 0; j >>= 1)
+    for (i = 0; i < rows; i++, bits += bitpitch, dest += pitch)
+    {
+        for (c = 0, d = dest; c < bytes; c++, d += words * 8)
         {
-            if (src[i] & j) {
-                switch(bpp) {
-                    case 1:
-                        *(Uint8 *)dest = color;
-                        break;
-                    case 2:
-                        *(Uint16 *)dest = color;
-                        break;
-                    case 3:
-                    case 4:
-                        *(Uint32 *)dest = color;
-                        break;
-                }
-            }
-            dest += bpp;
+            if (bits[c] == 0)
+                continue;
+
+            mask = glyph_masks[bits[c]];
+            for (k = 0; k < words; k++)
+            {
+                memcpy(&pixels, d + (k * 8), 8);
+                pixels = (pixels & ~mask[k]) | (pattern[k] & mask[k]);
+                memcpy(d + (k * 8), &pixels, 8);
+            } // for
         } // for
+    } // for
+}
+
+static inline void loki_2dmsg_internal_drawBits(Uint8 *dest, int pitch, int bpp,
+                                         const Uint8 *bits, int bitpitch,
+                                         int bytes, int rows,
+                                         const Uint64 *pattern)
+{
+    switch(bpp) {
+        case 1:
+            loki_2dmsg_internal_printGlyph(dest, pitch, bits, bitpitch,
+                                           bytes, rows, pattern, 1);
+            break;
+        case 2:
+            loki_2dmsg_internal_printGlyph(dest, pitch, bits, bitpitch,
+                                           bytes, rows, pattern, 2);
+            break;
+        case 3:
+            loki_2dmsg_internal_printGlyph(dest, pitch, bits, bitpitch,
+                                           bytes, rows, pattern, 3);
+            break;
+        case 4:
+            loki_2dmsg_internal_printGlyph(dest, pitch, bits, bitpitch,
+                                           bytes, rows, pattern, 4);
+            break;
+    }
+}
+
+/*
+ * The font and the whole number it is scaled up by.
+ */
+#define MAX_FONT_SCALE 8
+
+static loki_font *msg_font = NULL;
+static int msg_scale = 1;
+
+void loki_2dmsg_setfont(loki_font *font, int scale)
+{
+    if (scale < 1)
+        scale = 1;
+    else if (scale > MAX_FONT_SCALE)
+        scale = MAX_FONT_SCALE;
+
+    msg_font = font;
+    msg_scale = scale;
+}
+
 
-        y++;
+const loki_font *loki_2dmsg_getfont(int *scale)
+{
+    if (scale != NULL)
+        *scale = msg_scale;
+
+    return(msg_font ? msg_font : loki_font_default());
+}
+
+/*
+ * Widen a row of font bits by the scale.
+ */
+static void loki_2dmsg_internal_scaleRow(Uint8 *dest, const Uint8 *src,
+                                         int w, int scale)
+{
+    int i;
+    int j;
+
+    memset(dest, 0, ((w * scale) + 7) / 8);
+    for (i = 0; i < w; i++)
+    {
+        if (src[i >> 3] & (0x80 >> (i & 7)))
+        {
+            for (j = i * scale; j < (i + 1) * scale; j++)
+                dest[j >> 3] |= 0x80 >> (j & 7);
+        } // if
     } // for
 }
 
+static inline void loki_2dmsg_internal_printChar(int x, int y,
+                                                 SDL_Surface *surface,
+                                                 const loki_font *font,
+                                                 int scale,
+                                                 const loki_glyph *glyph,
+                                                 const Uint64 *pattern)
+{
+    int bpp = surface->format->BytesPerPixel;
+    const Uint8 *bits;
+    Uint8 row[(255 * MAX_FONT_SCALE + 7) / 8];
+    Uint8 *dest;
+    int bytes;
+    int i;
+
+    bits = font->atlas + (glyph->y * font->atlas_pitch) + (glyph->x / 8);
+    dest = (Uint8 *) surface->pixels + (surface->pitch * y) + (x * bpp);
+    if (scale == 1)
+    {
+        loki_2dmsg_internal_drawBits(dest, surface->pitch, bpp,
+                                     bits, font->atlas_pitch,
+                                     (glyph->w + 7) / 8, glyph->h, pattern);
+        return;
+    } // if
+
+    /* Each row is widened, and then drawn 'scale' times. */
+    bytes = ((glyph->w * scale) + 7) / 8;
+    for (i = 0; i < glyph->h; i++)
+    {
+        loki_2dmsg_internal_scaleRow(row, bits, glyph->w, scale);
+        loki_2dmsg_internal_drawBits(dest, surface->pitch, bpp,
+                                     row, 0, bytes, scale, pattern);
+        bits += font->atlas_pitch;
+        dest += surface->pitch * scale;
+    } // for
+}
+
+/*
+ * The surface being drawn on between loki_2dmsg_begin() and
+ *  loki_2dmsg_end(), and the last color used, expanded into a row.
+ */
+static SDL_Surface *batch_surface = NULL;
+static int batch_onscreen = 0;
+static Uint64 batch_pattern[4];
+static Uint32 batch_color = 0;
+static int batch_bpp = 0;
+
 static inline void loki_2dmsg_internal_printString(int x, int y,
                                                    SDL_Surface *surface,
                                                    const char *str,
-                                                   Uint32 color)
+                                                   int len, Uint32 color)
 {
-    if (SDL_MUSTLOCK(surface))
-        SDL_LockSurface(surface);
+    const char *end = str + len;
+    const loki_font *font = msg_font ? msg_font : loki_font_default();
+    const loki_glyph *glyph;
+    int bpp = surface->format->BytesPerPixel;
+    int scale = msg_scale;
+    Uint64 *pattern = batch_pattern;
+    int left = surface->w;
+    int right = 0;
+    int top = surface->h;
+    int bottom = 0;
+    unsigned int ch;
+    int gx, gy, gw, gh;
+
+    loki_2dmsg_internal_expandFont(bpp);
+    if ((color != batch_color) || (bpp != batch_bpp))
+    {
+        loki_2dmsg_internal_expandColor(pattern, bpp, color);
+        batch_color = color;
+        batch_bpp = bpp;
+    } // if
+
+    while (str < end)
+    {
+        /* Plain ASCII doesn't need decoding. */
+        ch = (unsigned char) *str;
+        if (ch < 0x80)
+            str++;
+        else
+            ch = loki_font_nextchar(&str);
+
+        glyph = loki_font_glyph(font, ch);
+        gx = x + (glyph->xoff * scale);
+        gy = y + (glyph->yoff * scale);
+        x += glyph->advance * scale;
+
+        /*
+         * Only whole characters that fit on the surface are drawn,
+         *  including the rest of the 8 pixels of their last column.
+         */
+        gw = (((glyph->w * scale) + 7) / 8) * 8;
+        gh = glyph->h * scale;
+        if ((gw == 0) || (gh == 0) || (gx < 0) || (gy < 0) ||
+            (gx + gw > surface->w) || (gy + gh > surface->h))
+            continue;
+
+        loki_2dmsg_internal_printChar(gx, gy, surface, font, scale,
+                                      glyph, pattern);
+
+        if (gx < left)
+            left = gx;
+        if (gx + (glyph->w * scale) > right)
+            right = gx + (glyph->w * scale);
+        if (gy < top)
+            top = gy;
+        if (gy + gh > bottom)
+            bottom = gy + gh;
+    } // while
+
+    if ((left < right) && (batch_onscreen))
+        loki_2dmsg_internal_addDirty(surface, left, top,
+                                     right - left, bottom - top);
+}
 
-    for (; *str != '\0'; str++, x += 10)
-        loki_2dmsg_internal_printChar(x, y, surface, *str, color);
 
+/*
+ * Lock the surface for drawing with loki_2dmsg_draw().
+ *  If surface is NULL, the screen is used.
+ *
+ *  returns -1 on error, 0 on success.
+ */
+int loki_2dmsg_begin(SDL_Surface *surface)
+{
+    if (surface == NULL)
+        surface = SDL_GetVideoSurface();
+
+    if ((surface == NULL) || (batch_surface != NULL))
+        return(-1);
+
+    if ((SDL_MUSTLOCK(surface)) && (SDL_LockSurface(surface) < 0))
+        return(-1);
+
+    batch_surface = surface;
+    batch_onscreen = (surface == SDL_GetVideoSurface());
+    return(0);
+}
+
+
+void loki_2dmsg_draw(int x, int y, float r, float g, float b, const char *str)
+{
+    Uint32 color;
+
+    if (batch_surface == NULL)
+        return;
+
+    color = SDL_MapRGB(batch_surface->format, r*255.0, g*255.0, b*255.0);
+    loki_2dmsg_internal_printString(x, y, batch_surface, str, strlen(str),
+                                    color);
+}
+
+
+/*
+ * Unlock the surface, and if it is the screen, update the parts drawn on.
+ */
+void loki_2dmsg_end(void)
+{
+    SDL_Surface *surface = batch_surface;
+
+    if (surface == NULL)
+        return;
+
+    batch_surface = NULL;
     if (SDL_MUSTLOCK(surface))
         SDL_UnlockSurface(surface);
 
-    SDL_UpdateRect(surface, 0, 0, 0, 0);
+    if ((batch_onscreen) && (!dirty_queued))
+        loki_2dmsg_update();
 }
 
 
-void loki_2dmsg_print(float r, float g, float b, const char *str)
+/*
+ * Center the first len bytes of str on the next line of the screen.
+ */
+void loki_2dmsg_printline(float r, float g, float b, const char *str, int len)
 {
     SDL_Surface *surface = SDL_GetVideoSurface();
+    const loki_font *font = msg_font ? msg_font : loki_font_default();
+    int textw = ((int) surface->w -
+                 (loki_font_textwidth(font, str, len) * msg_scale)) / 2;
     Uint32 color;
-    int textw = ((int) surface->w - ((int) (strlen(str) * 10))) / 2;
 
     #ifdef STANDALONE
         printf("loki_2dmsg_print(): Should write this to the frame buffer:\n"
-               "\"%s\"\n", str);
+               "\"%.*s\"\n", len, str);
     #endif
 
-    color = SDL_MapRGB(surface->format, r*255.0, g*255.0, b*255.0);
-    loki_2dmsg_internal_printString(textw, texty, surface, str, color);
+    if (loki_2dmsg_begin(surface) == 0)
+    {
+        color = SDL_MapRGB(surface->format, r*255.0, g*255.0, b*255.0);
+        loki_2dmsg_internal_printString(textw, texty, surface, str, len,
+                                        color);
+        loki_2dmsg_end();
+    } // if
 
-    texty += 15;
+    texty += font->height * msg_scale;
     if (texty <= 0)
         texty = 0;
 }
 
 
+void loki_2dmsg_print(float r, float g, float b, const char *str)
+{
+    loki_2dmsg_printline(r, g, b, str, strlen(str));
+}
+
+
 #ifdef STANDALONE  // for testing only.  --ryan.
 static inline void do_delay(int ms)
 {
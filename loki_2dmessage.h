@@ -20,12 +20,40 @@
 #ifndef _LOKI_2DMESSAGE_H
 #define _LOKI_2DMESSAGE_H
 
+#include "SDL.h"
+#include "loki_font.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int loki_2dmsg_initialize(float bgr, float bgg, float bgb);
 void loki_2dmsg_print(float r, float g, float b, const char *str);
+void loki_2dmsg_printline(float r, float g, float b, const char *str, int len);
+void loki_2dmsg_queue(void);
+void loki_2dmsg_update(void);
+
+/*
+ * Draw many strings with one lock and one screen update:
+ *  loki_2dmsg_begin() locks the surface, which can be offscreen, or NULL
+ *  for the screen.  loki_2dmsg_draw() puts a string at (x, y) in pixels,
+ *  and loki_2dmsg_end() unlocks the surface and updates the screen.
+ *  Don't call loki_2dmsg_print() between begin and end.
+ */
+int loki_2dmsg_begin(SDL_Surface *surface);
+void loki_2dmsg_draw(int x, int y, float r, float g, float b, const char *str);
+void loki_2dmsg_end(void);
+
+/*
+ * Draw with the font, scaled up by a whole number from 1 to 8.
+ *  If font is NULL, the built-in 8x8 font is used.
+ */
+void loki_2dmsg_setfont(loki_font *font, int scale);
+
+/*
+ * Return the font being drawn with, and the scale if scale isn't NULL.
+ */
+const loki_font *loki_2dmsg_getfont(int *scale);
 
 #ifdef __cplusplus
 }
@@ -1,6 +1,9 @@
 
 /* Code to detect certain processor features */
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <cpuid.h>
+#endif
 #include "loki_cpuinfo.h"
 
 
@@ -166,6 +169,28 @@ int loki_getcpuflags(void)
     }
 #endif /* GCC and x86 */
 
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    /* The newer SSE extensions, and everything on x86_64 */
+    {
+	unsigned int eax, ebx, ecx, edx;
+
+	if ( __get_cpuid(1, &eax, &ebx, &ecx, &edx) ) {
+		if ( edx & bit_MMX ) {
+			flags |= CPU_HAS_MMX;
+		}
+		if ( edx & bit_SSE ) {
+			flags |= CPU_HAS_SSE;
+		}
+		if ( edx & bit_SSE2 ) {
+			flags |= CPU_HAS_SSE2;
+		}
+		if ( ecx & bit_SSSE3 ) {
+			flags |= CPU_HAS_SSSE3;
+		}
+	}
+    }
+#endif /* GCC and x86 */
+
     return flags;
 }
 
@@ -193,6 +218,12 @@ int main(int argc, char *argv[])
 	if ( cpu_flags & CPU_HAS_SSE ) {
 		printf(" SSE");
 	}
+	if ( cpu_flags & CPU_HAS_SSE2 ) {
+		printf(" SSE2");
+	}
+	if ( cpu_flags & CPU_HAS_SSSE3 ) {
+		printf(" SSSE3");
+	}
 	printf("\n");
 	exit(0);
 }
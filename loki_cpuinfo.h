@@ -12,6 +12,8 @@
 #define CPU_HAS_EMMX	0x0002		/* Cyrix extended MMX */
 #define CPU_HAS_3DNOW	0x0004		/* AMD 3DNow! */
 #define CPU_HAS_SSE	0x0008		/* Pentium III SSE */
+#define CPU_HAS_SSE2	0x0010		/* Pentium 4 SSE2 */
+#define CPU_HAS_SSSE3	0x0020		/* Core 2 Supplemental SSE3 */
 
 extern int loki_getcpuflags(void);
 
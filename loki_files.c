@@ -18,75 +18,246 @@
 */
 /* $Id$ */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
+#include <sys/time.h>
 
 #include "loki_utils.h"
 
 
+
+/* These are in loki_paths.c */
+extern int loki_getprefpathfd_internal(void);
+extern int loki_getdatapathfd_internal(void);
+
+/* These are in loki_filetrace.c */
+extern int loki_filetrace_start_internal(struct timeval *start);
+extern void loki_filetrace_internal(const char *op, const char *file,
+                                    int root, int probes, int scans, long size,
+                                    const struct timeval *start);
+
+/* The search pass reported to the trace for full pathnames */
+#define PASS_ABSOLUTE   4
+
+/* Get the size of an open file for the access trace */
+static long trace_size(int fd)
+{
+    struct stat sb;
+
+    if ( (fd >= 0) && (fstat(fd, &sb) == 0) ) {
+        return (long)sb.st_size;
+    }
+    return -1;
+}
+
+/* Get the directory that should be used to look up files in the given
+   search pass.  The preferences and data directories are held open, so
+   lookups there don't need any string work.  The CD-ROM directory is only
+   opened for the duration of the lookup, holding it would keep it from
+   being ejected.  Returns -1 if there is nothing to look up in this pass.
+ */
+static int search_root(int pass)
+{
+    int dirfd;
+
+    switch (pass) {
+        case 0:
+            dirfd = loki_getprefpathfd_internal();
+            break;
+        case 1:
+            dirfd = loki_getdatapathfd_internal();
+            break;
+        case 2:
+            dirfd = -1;
+            if ( loki_hascdrompath() ) {
+                dirfd = open(loki_getcdrompath(), O_RDONLY|O_DIRECTORY);
+            }
+            break;
+        default:
+            dirfd = AT_FDCWD;
+            break;
+    }
+    return dirfd;
+}
+
+static void release_root(int pass, int dirfd)
+{
+    if ( (pass == 2) && (dirfd >= 0) ) {
+        close(dirfd);
+    }
+}
+
 int loki_stat(const char *file, struct stat *statb)
 {
-    char path[PATH_MAX];
-    int pass;
+    struct timeval start;
+    int tracing;
+    int pass, dirfd;
     int value;
 
+    tracing = loki_filetrace_start_internal(&start);
+
     /* If it's a full pathname, we're fine */
     if ( *file == '/' ) {
-        return stat(file, statb);
+        value = stat(file, statb);
+        pass = PASS_ABSOLUTE+1;
+    } else {
+        /* First look in preferences, then in data and cdrom directories */
+        value = -1;
+        for ( pass = 0; (value < 0) && (pass < 4); ++pass ) {
+            dirfd = search_root(pass);
+            if ( dirfd != -1 ) {
+                value = fstatat(dirfd, file, statb, 0);
+                release_root(pass, dirfd);
+            }
+        }
     }
+    if ( tracing ) {
+        loki_filetrace_internal("stat", file, (value < 0) ? -1 : pass-1,
+                                (pass > 4) ? 1 : pass, 0,
+                                (value < 0) ? -1 : (long)statb->st_size, &start);
+    }
+    return value;
+}
 
-    /* First look in preferences, then in data and cdrom directories */
-    value = -1;
-    for ( pass = 0; (value < 0) && (pass < 4); ++pass ) {
-        switch (pass) {
-            case 0:
-                strcpy(path, loki_getprefpath());
-                break;
-            case 1:
-                strcpy(path, loki_getdatapath());
-                break;
-            case 2:
-                strcpy(path, loki_getcdrompath());
-                break;
-            case 3:
-                strcpy(path, ".");
-                break;
+/* Directories we have already created or seen, so that creating more
+   directories in the same tree doesn't cost a system call for each one
+   above them.  A directory can be removed while we run, so an entry is
+   only trusted until a path under it turns out to be missing.
+ */
+#define KNOWN_DIRS  16
+
+static struct {
+    int dirfd;
+    char *path;
+    int len;
+} known_dirs[KNOWN_DIRS];
+static int known_next = 0;
+
+static int known_dir_len(int dirfd, const char *path, int len)
+{
+    int i, best;
+
+    best = 0;
+    for ( i=0; i<KNOWN_DIRS; ++i ) {
+        int known = known_dirs[i].len;
+        if ( (known > best) && (known <= len) &&
+             (known_dirs[i].dirfd == dirfd) &&
+             ((path[known] == '/') || (known == len)) &&
+             (memcmp(known_dirs[i].path, path, known) == 0) ) {
+            best = known;
         }
-        if ( path[0] ) {
-            strcat(path, "/");
-            strcat(path, file);
-            value = stat(path, statb);
+    }
+    return best;
+}
+
+/* Forget the directory 'path' and the known directories above it */
+static void forget_known_dirs(int dirfd, const char *path, int len)
+{
+    int i;
+
+    for ( i=0; i<KNOWN_DIRS; ++i ) {
+        int known = known_dirs[i].len;
+        if ( (known > 0) && (known <= len) &&
+             (known_dirs[i].dirfd == dirfd) &&
+             ((path[known] == '/') || (known == len)) &&
+             (memcmp(known_dirs[i].path, path, known) == 0) ) {
+            free(known_dirs[i].path);
+            known_dirs[i].path = NULL;
+            known_dirs[i].len = 0;
         }
     }
-    return value;
 }
 
-/* Create the directories in the heirarchy above this path, if necessary */
-static int mkdirhier(const char *path)
+/* Forget all the known directories, the directory fds they are relative
+   to are being closed and the numbers may be reused.
+ */
+void loki_forgetdirs_internal(void)
+{
+    int i;
+
+    for ( i=0; i<KNOWN_DIRS; ++i ) {
+        free(known_dirs[i].path);
+        known_dirs[i].path = NULL;
+        known_dirs[i].len = 0;
+    }
+}
+
+static void add_known_dir(int dirfd, const char *path, int len)
+{
+    char *copy;
+
+    copy = (char *)malloc(len+1);
+    if ( copy ) {
+        memcpy(copy, path, len);
+        copy[len] = '\0';
+        free(known_dirs[known_next].path);
+        known_dirs[known_next].dirfd = dirfd;
+        known_dirs[known_next].path = copy;
+        known_dirs[known_next].len = len;
+        known_next = (known_next + 1) % KNOWN_DIRS;
+    }
+}
+
+/* Create the directories in the heirarchy above this path, if necessary.
+   The path is relative to the directory 'dirfd', as with mkdirat().
+   This is called when the path couldn't be opened because a directory
+   is missing, so the directory itself isn't taken from the known ones.
+ */
+static int mkdirhier(int dirfd, const char *path)
 {
     int retval;
-    char *bufp, *new_path;
-    struct stat sb;
+    char new_path[PATH_MAX], *bufp;
+    int len, known;
 
     retval = 0;
     if ( path && *path ) {
-        new_path = strdup(path);
-        for ( bufp=new_path+1; *bufp; ++bufp ) {
-            if ( *bufp == '/' ) {
+        bufp = strrchr(path, '/');
+        len = bufp ? (bufp - path) : 0;
+        if ( (len == 0) || (len >= sizeof(new_path)) ) {
+            return(retval);
+        }
+        memcpy(new_path, path, len);
+        new_path[len] = '\0';
+
+        /* Skip the part of the path we already know exists */
+        forget_known_dirs(dirfd, new_path, len);
+        known = known_dir_len(dirfd, new_path, len);
+        bufp = new_path + known;
+
+        for ( ; ; ++bufp ) {
+            char c = *bufp;
+            if ( ((c == '/') || (c == '\0')) &&
+                 (bufp > new_path) && (bufp[-1] != '/') ) {
                 *bufp = '\0';
-                if ( stat(new_path, &sb) < 0 ) {
-                    retval = mkdir(new_path, 0755);
+                if ( (mkdirat(dirfd, new_path, 0755) < 0) &&
+                     (errno != EEXIST) ) {
+                    if ( (errno == ENOENT) && (known > 0) ) {
+                        /* A directory we knew about is gone, start over */
+                        forget_known_dirs(dirfd, new_path, known);
+                        return(mkdirhier(dirfd, path));
+                    }
+                    retval = -1;
                 }
-                *bufp = '/';
+                *bufp = c;
+            }
+            if ( c == '\0' ) {
+                break;
             }
         }
-        free(new_path);
+        if ( retval == 0 ) {
+            add_known_dir(dirfd, new_path, len);
+        }
     }
     return(retval);
 }
@@ -153,90 +324,135 @@ FILE *loki_fopen_nocase(const char *file, const char *mode)
     return value;
 }
 
+/* Convert an fopen() mode string into open() flags */
+static int fopen_flags(const char *mode)
+{
+    int flags;
+
+    switch (*mode) {
+        case 'w':
+            flags = O_WRONLY|O_CREAT|O_TRUNC;
+            break;
+        case 'a':
+            flags = O_WRONLY|O_CREAT|O_APPEND;
+            break;
+        default:
+            flags = O_RDONLY;
+            break;
+    }
+    if ( strchr(mode, '+') ) {
+        flags = (flags & ~(O_RDONLY|O_WRONLY)) | O_RDWR;
+    }
+    return flags;
+}
+
+static FILE *fopen_at(int dirfd, const char *file, const char *mode)
+{
+    FILE *value;
+    int fd;
+
+    value = NULL;
+    fd = openat(dirfd, file, fopen_flags(mode), 0666);
+    if ( fd >= 0 ) {
+        value = fdopen(fd, mode);
+        if ( ! value ) {
+            close(fd);
+        }
+    }
+    return value;
+}
+
 FILE *loki_fopen(const char *file, const char *mode)
 {
-    char path[PATH_MAX];
-    int pass;
+    struct timeval start;
+    int tracing;
+    int pass, dirfd;
     FILE *value;
 
+    tracing = loki_filetrace_start_internal(&start);
+
     /* If it's a full pathname, we're fine */
     if ( *file == '/' ) {
-        return fopen(file, mode);
-    }
-
-    /* If we're writing, we must write to the preferences */
-    if ( (*mode == 'w') || (*mode == 'a') ) {
-        sprintf(path, "%s/%s", loki_getprefpath(), file);
-        mkdirhier(path);
-        value = fopen(path, mode);
+        value = fopen(file, mode);
+        pass = PASS_ABSOLUTE+1;
+    } else if ( (*mode == 'w') || (*mode == 'a') ) {
+        /* If we're writing, we must write to the preferences */
+        value = 0;
+        pass = 1;
+        dirfd = loki_getprefpathfd_internal();
+        if ( dirfd >= 0 ) {
+            value = fopen_at(dirfd, file, mode);
+            if ( !value && (errno == ENOENT) &&
+                 (mkdirhier(dirfd, file) == 0) ) {
+                value = fopen_at(dirfd, file, mode);
+            }
+        }
     } else {
         /* First look in preferences, then in data directory */
         value = 0;
         for ( pass = 0; !value && (pass < 4); ++pass ) {
-            switch (pass) {
-                case 0:
-                    strcpy(path, loki_getprefpath());
-                    break;
-                case 1:
-                    strcpy(path, loki_getdatapath());
-                    break;
-                case 2:
-                    strcpy(path, loki_getcdrompath());
-                    break;
-                case 3:
-                    strcpy(path, ".");
-                    break;
-            }
-            if ( path[0] ) {
-                strcat(path, "/");
-                strcat(path, file);
-                value = fopen(path, mode);
+            dirfd = search_root(pass);
+            if ( dirfd != -1 ) {
+                value = fopen_at(dirfd, file, mode);
+                release_root(pass, dirfd);
             }
         }
     }
+    if ( tracing ) {
+        loki_filetrace_internal("fopen", file, value ? pass-1 : -1,
+                                (pass > 4) ? 1 : pass, 0,
+                                value ? trace_size(fileno(value)) : -1, &start);
+    }
     return value;
 }
 
-/* A case insensitive open function */
-static int open_nocase(const char *path, const char *file,
-                       int flags, mode_t mode)
+/* A case insensitive open function, relative to the directory 'dirfd'.
+   The number of directories that had to be scanned is added to 'scans'.
+ */
+static int open_nocase(int dirfd, const char *file, int flags, mode_t mode,
+                       int *scans)
 {
-    char full_path[PATH_MAX];
+    char base[NAME_MAX+1];
     int value;
 
-    snprintf(full_path, sizeof(full_path), "%s/%s", path, file);
-    value = open(full_path, flags, mode);
+    value = openat(dirfd, file, flags, mode);
     if ( value < 0 ) {
-        char *base, *sep;
+        const char *sep;
         DIR *dirp;
         struct dirent *entry;
+        int len, fd;
 
         /* Get the base of the path */
-        base = full_path + strlen(path) + 1;
-        sep = strchr(base, '/');
-        if ( sep ) {
-            *sep = '\0';
-            file += (sep-base)+1;
-        } else {
-            file = 0;
+        sep = strchr(file, '/');
+        len = sep ? (sep - file) : strlen(file);
+        if ( (len == 0) || (len >= sizeof(base)) ) {
+            return value;
         }
-        sep = strrchr(full_path, '/');
-        *sep = '\0';
+        memcpy(base, file, len);
+        base[len] = '\0';
 
-        dirp = opendir(full_path);
+        /* fdopendir() takes over the descriptor, so give it its own */
+        fd = openat(dirfd, ".", O_RDONLY|O_DIRECTORY);
+        dirp = (fd >= 0) ? fdopendir(fd) : NULL;
         if ( dirp ) {
-            *sep = '/';
+            ++*scans;
             while ( (value < 0) && ((entry=readdir(dirp)) != NULL) ) {
                 if ( strcasecmp(entry->d_name, base) == 0 ) {
-                    strcpy(base, entry->d_name);
-                    if ( file ) {
-                        value = open_nocase(full_path, file, flags, mode);
+                    if ( sep ) {
+                        fd = openat(dirfd, entry->d_name, O_RDONLY|O_DIRECTORY);
+                        if ( fd >= 0 ) {
+                            value = open_nocase(fd, sep+1, flags, mode,
+                                                    scans);
+                            close(fd);
+                        }
                     } else {
-                        value = open(full_path, flags, mode);
+                        value = openat(dirfd, entry->d_name, flags, mode);
                     }
                 }
             }
             closedir(dirp);
+        } else if ( fd >= 0 ) {
+            close(fd);
         }
     }
     return value;
@@ -244,51 +460,144 @@ static int open_nocase(const char *path, const char *file,
 
 int loki_open(const char *file, int flags, mode_t mode)
 {
+    struct timeval start;
+    int tracing, scans;
     int value;
+    int pass, dirfd;
+
+    tracing = loki_filetrace_start_internal(&start);
+    scans = 0;
 
     /* If it's a full pathname, we're fine */
     if ( *file == '/' ) {
-        mkdirhier(file);
-        return open(file, flags, mode);
-    }
-
-    /* If we're writing, we must write to the preferences */
-    if ( flags == O_RDONLY ) {
-        char *path = 0;
-        int pass;
-
+        value = open(file, flags, mode);
+        if ( (value < 0) && (errno == ENOENT) &&
+             (mkdirhier(AT_FDCWD, file) == 0) ) {
+            value = open(file, flags, mode);
+        }
+        pass = PASS_ABSOLUTE+1;
+    } else if ( flags == O_RDONLY ) {
         /* First look in preferences, then in data directory */
         value = -1;
         for ( pass = 0; (value < 0) && (pass < 4); ++pass ) {
-            switch (pass) {
-                case 0:
-                    path = loki_getprefpath();
-                    break;
-                case 1:
-                    path = loki_getdatapath();
-                    break;
-                case 2:
-                    path = loki_getcdrompath();
-                    break;
-                case 3:
-                    path = ".";
-                    break;
-            }
-            if ( path[0] ) {
-                value = open_nocase(path, file, O_RDONLY, 0);
+            dirfd = search_root(pass);
+            if ( dirfd != -1 ) {
+                value = open_nocase(dirfd, file, O_RDONLY, 0, &scans);
+                release_root(pass, dirfd);
             }
         }
     } else {
-        char path[PATH_MAX];
-
-        sprintf(path, "%s/%s", loki_getprefpath(), file);
-        if ( flags & O_CREAT ) {
-                mkdirhier(path);
+        /* If we're writing, we must write to the preferences */
+        value = -1;
+        pass = 1;
+        dirfd = loki_getprefpathfd_internal();
+        if ( dirfd >= 0 ) {
+            value = openat(dirfd, file, flags, mode);
+            if ( (value < 0) && (flags & O_CREAT) && (errno == ENOENT) &&
+                 (mkdirhier(dirfd, file) == 0) ) {
+                value = openat(dirfd, file, flags, mode);
+            }
         }
-        value = open(path, flags, mode);
         if ( (value < 0) && (flags & O_RDWR) ) {
             /* Uh oh, need to copy from install path? */ ;
         }
     }
+    if ( tracing ) {
+        loki_filetrace_internal("open", file, (value < 0) ? -1 : pass-1,
+                                (pass > 4) ? 1 : pass, scans,
+                                trace_size(value), &start);
+    }
     return value;
 }
+
+/* The state handed to the background prefetch thread */
+typedef struct prefetch_list {
+    size_t budget;
+    char **files;
+} prefetch_list;
+
+static void *prefetch_thread(void *data)
+{
+    prefetch_list *list = (prefetch_list *)data;
+    size_t budget = list->budget;
+    int unlimited = (budget == 0);
+    struct stat sb;
+    off_t len;
+    int i, fd;
+
+    for ( i=0; list->files[i] && (unlimited || budget); ++i ) {
+        fd = loki_open(list->files[i], O_RDONLY, 0);
+        if ( fd < 0 ) {
+            continue;
+        }
+        if ( (fstat(fd, &sb) == 0) && S_ISREG(sb.st_mode) ) {
+            len = sb.st_size;
+            if ( !unlimited && ((size_t)len > budget) ) {
+                len = budget;
+            }
+            /* Both of these only queue the reads, they don't wait for them */
+            if ( posix_fadvise(fd, 0, len, POSIX_FADV_WILLNEED) != 0 ) {
+                readahead(fd, 0, len);
+            }
+            if ( ! unlimited ) {
+                budget -= len;
+            }
+        }
+        close(fd);
+    }
+
+    for ( i=0; list->files[i]; ++i ) {
+        free(list->files[i]);
+    }
+    free(list->files);
+    free(list);
+    return NULL;
+}
+
+/* Start warming the page cache for a NULL terminated list of files */
+int loki_prefetch(const char *files[], size_t budget)
+{
+    prefetch_list *list;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int i, count, retval;
+
+    for ( count=0; files[count]; ++count )
+        ;
+
+    /* Copy the list, the caller's strings may be gone by the time we run */
+    list = (prefetch_list *)malloc(sizeof *list);
+    if ( ! list ) {
+        return -1;
+    }
+    list->budget = budget;
+    list->files = (char **)calloc(count+1, sizeof(char *));
+    if ( ! list->files ) {
+        free(list);
+        return -1;
+    }
+    for ( i=0; i<count; ++i ) {
+        list->files[i] = strdup(files[i]);
+        if ( ! list->files[i] ) {
+            break;
+        }
+    }
+
+    retval = -1;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if ( (i == count) &&
+         (pthread_create(&thread, &attr, prefetch_thread, list) == 0) ) {
+        retval = 0;
+    }
+    pthread_attr_destroy(&attr);
+
+    if ( retval < 0 ) {
+        for ( i=0; list->files[i]; ++i ) {
+            free(list->files[i]);
+        }
+        free(list->files);
+        free(list);
+    }
+    return retval;
+}
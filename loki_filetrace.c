@@ -0,0 +1,191 @@
+/*
+    Loki Game Utility Functions
+    Copyright (C) 1999  Loki Software, Inc.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* File access tracing for loki_stat(), loki_fopen() and loki_open()
+
+   Tracing is enabled by setting the LOKI_FILETRACE environment variable.
+   A summary of how the lookups were resolved, along with the time taken by
+   loki_initpaths(), is printed to standard error when the program exits.
+   If the variable is set to anything other than "1", it is taken as the
+   name of a file to which every lookup is logged, one per line, as tab
+   separated fields:
+	operation root probes nocase-scans microseconds size name
+   The packorder tool turns such a trace into a file order for packing.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "loki_utils.h"
+
+/* The roots a file can be found in, in search order */
+static const char *root_names[] = {
+    "pref", "data", "cdrom", "cwd", "abs", "missed"
+};
+#define NUM_ROOTS   (sizeof(root_names)/sizeof(root_names[0]))
+#define ROOT_MISSED (NUM_ROOTS-1)
+
+static const char *op_names[] = {
+    "stat", "fopen", "open"
+};
+#define NUM_OPS     (sizeof(op_names)/sizeof(op_names[0]))
+
+static struct {
+    unsigned long calls;
+    unsigned long hits[NUM_ROOTS];
+    unsigned long probes;
+    unsigned long scans;
+    double usec;
+} trace_stats[NUM_OPS];
+
+/* Startup phases which have been timed */
+#define MAX_PHASES  8
+
+static struct {
+    const char *name;
+    double usec;
+} trace_phases[MAX_PHASES];
+static int num_phases = 0;
+
+static int trace_state = -1;
+static FILE *trace_fp = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void loki_filetrace_report(void)
+{
+    int op, root;
+
+    pthread_mutex_lock(&trace_lock);
+    for ( op=0; op<num_phases; ++op ) {
+        fprintf(stderr, "Loki startup: %s took %.3f msec\n",
+                trace_phases[op].name, trace_phases[op].usec / 1000.0);
+    }
+    fprintf(stderr, "Loki file access report:\n");
+    fprintf(stderr, "  %-6s %7s", "op", "calls");
+    for ( root=0; root<NUM_ROOTS; ++root ) {
+        fprintf(stderr, " %6s", root_names[root]);
+    }
+    fprintf(stderr, " %7s %7s %9s\n", "probes", "nocase", "msec");
+    for ( op=0; op<NUM_OPS; ++op ) {
+        if ( ! trace_stats[op].calls ) {
+            continue;
+        }
+        fprintf(stderr, "  %-6s %7lu", op_names[op], trace_stats[op].calls);
+        for ( root=0; root<NUM_ROOTS; ++root ) {
+            fprintf(stderr, " %6lu", trace_stats[op].hits[root]);
+        }
+        fprintf(stderr, " %7.2f %7lu %9.3f\n",
+                (double)trace_stats[op].probes / trace_stats[op].calls,
+                trace_stats[op].scans, trace_stats[op].usec / 1000.0);
+    }
+    if ( trace_fp ) {
+        fclose(trace_fp);
+        trace_fp = NULL;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* Returns whether tracing is enabled, and if so, the current time */
+int loki_filetrace_start_internal(struct timeval *start)
+{
+    if ( trace_state < 0 ) {
+        const char *env;
+
+        pthread_mutex_lock(&trace_lock);
+        if ( trace_state < 0 ) {
+            env = getenv("LOKI_FILETRACE");
+            if ( env && *env ) {
+                if ( strcmp(env, "1") != 0 ) {
+                    trace_fp = fopen(env, "w");
+                    if ( ! trace_fp ) {
+                        perror(env);
+                    }
+                }
+                atexit(loki_filetrace_report);
+                trace_state = 1;
+            } else {
+                trace_state = 0;
+            }
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+    if ( trace_state ) {
+        gettimeofday(start, NULL);
+    }
+    return trace_state;
+}
+
+static double elapsed_usec(const struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000000.0 +
+           (now.tv_usec - start->tv_usec);
+}
+
+/* Record how long a phase of the library startup took */
+void loki_filetrace_phase_internal(const char *phase,
+                                   const struct timeval *start)
+{
+    double usec = elapsed_usec(start);
+
+    pthread_mutex_lock(&trace_lock);
+    if ( num_phases < MAX_PHASES ) {
+        trace_phases[num_phases].name = phase;
+        trace_phases[num_phases].usec = usec;
+        ++num_phases;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* Record a lookup of 'file' which was found in the search pass 'root',
+   or -1 if it wasn't found at all.  'size' is the size of the file found.
+ */
+void loki_filetrace_internal(const char *op, const char *file,
+                             int root, int probes, int scans, long size,
+                             const struct timeval *start)
+{
+    double usec = elapsed_usec(start);
+    int i;
+
+    if ( (root < 0) || (root >= ROOT_MISSED) ) {
+        root = ROOT_MISSED;
+    }
+    for ( i=0; i<(NUM_OPS-1); ++i ) {
+        if ( strcmp(op, op_names[i]) == 0 ) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    trace_stats[i].calls++;
+    trace_stats[i].hits[root]++;
+    trace_stats[i].probes += probes;
+    trace_stats[i].scans += scans;
+    trace_stats[i].usec += usec;
+    if ( trace_fp ) {
+        fprintf(trace_fp, "%s\t%s\t%d\t%d\t%.0f\t%ld\t%s\n",
+                op_names[i], root_names[root], probes, scans, usec, size, file);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
@@ -0,0 +1,365 @@
+/*
+    Loki Game Utility Functions
+    Copyright (C) 1999  Loki Entertainment Software
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Bitmap fonts for the message code.
+
+   The font file is laid out as follows, all values little endian:
+
+     0  "LFNT"
+     4  version (1), 16 bits
+     6  number of glyphs, 16 bits
+     8  line height, 16 bits
+    10  glyph used for missing characters, 16 bits
+    12  atlas width and height, 16 bits each
+    16  the glyphs, 16 bytes each:
+          0  character, 32 bits
+          4  x and y in the atlas, 16 bits each, x a multiple of 8
+          8  width, height, x offset and y offset, 8 bits each
+         12  advance, 8 bits, and 3 bytes of padding
+        followed by the atlas, 1 bit per pixel, (width+7)/8 bytes per row
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loki_font.h"
+
+#define FONT_VERSION        1
+#define FONT_HEADER_SIZE    16
+#define FONT_GLYPH_SIZE     16
+
+#define FONT_LE16(p)    ((unsigned int)((p)[0] | ((p)[1] << 8)))
+#define FONT_LE32(p)    ((unsigned int)((p)[0] | ((p)[1] << 8) | \
+                         ((p)[2] << 16) | ((unsigned int)(p)[3] << 24)))
+
+extern unsigned char loki_fontchars[][8];
+
+static loki_font default_font;
+static loki_glyph default_glyphs[128];
+static unsigned short default_page[256];
+static unsigned char default_atlas[64 * 16];
+
+/* Map a character to a glyph, characters past 0xFFFF can't be mapped */
+static int loki_font_addchar(loki_font *font, unsigned int ch, int glyph)
+{
+    unsigned short *page;
+
+    if ( ch > 0xFFFF ) {
+        return 0;
+    }
+    page = font->pages[ch >> 8];
+    if ( ! page ) {
+        page = (unsigned short *)calloc(256, sizeof(*page));
+        if ( ! page ) {
+            return -1;
+        }
+        font->pages[ch >> 8] = page;
+    }
+    page[ch & 0xFF] = glyph + 1;
+    return 0;
+}
+
+loki_font *loki_font_default(void)
+{
+    loki_glyph *glyph;
+    int i, row;
+
+    if ( default_font.glyphs ) {
+        return &default_font;
+    }
+
+    /* The built-in glyphs are put 16 across, loki_fontchars has the
+       bottom row of each one first.
+     */
+    default_font.atlas_w = 128;
+    default_font.atlas_h = 64;
+    default_font.atlas_pitch = 16;
+    default_font.atlas = default_atlas;
+    for ( i = 0; i < 128; ++i ) {
+        glyph = &default_glyphs[i];
+        glyph->x = (i % 16) * 8;
+        glyph->y = (i / 16) * 8;
+        glyph->w = 8;
+        glyph->h = 8;
+        glyph->xoff = 0;
+        glyph->yoff = 0;
+        glyph->advance = 10;
+        for ( row = 0; row < 8; ++row ) {
+            default_atlas[(glyph->y + row) * 16 + (i % 16)] =
+                loki_fontchars[i][7 - row];
+        }
+        /* Blank ones like the space have nothing to draw */
+        if ( ! memcmp(loki_fontchars[i], "\0\0\0\0\0\0\0\0", 8) ) {
+            glyph->w = 0;
+            glyph->h = 0;
+        }
+        default_page[i] = i + 1;
+    }
+    default_font.height = 15;
+    default_font.nglyphs = 128;
+    default_font.missing = 0;       /* This one is blank */
+    default_font.pages[0] = default_page;
+    default_font.glyphs = default_glyphs;
+    return &default_font;
+}
+
+void loki_font_free(loki_font *font)
+{
+    int i;
+
+    if ( font && (font != &default_font) ) {
+        for ( i = 0; i < 256; ++i ) {
+            free(font->pages[i]);
+        }
+        free(font->glyphs);
+        free(font->atlas);
+        free(font);
+    }
+}
+
+loki_font *loki_font_load(const char *path)
+{
+    FILE *fp;
+    loki_font *font;
+    loki_glyph *glyph;
+    unsigned char header[FONT_HEADER_SIZE], record[FONT_GLYPH_SIZE];
+    size_t size;
+    int i;
+
+    fp = fopen(path, "rb");
+    if ( ! fp ) {
+        return NULL;
+    }
+    font = (loki_font *)calloc(1, sizeof(*font));
+    if ( ! font ) {
+        fclose(fp);
+        return NULL;
+    }
+    if ( (fread(header, sizeof(header), 1, fp) != 1) ||
+         (memcmp(header, "LFNT", 4) != 0) ||
+         (FONT_LE16(header + 4) != FONT_VERSION) ) {
+        fprintf(stderr, "%s is not a font file\n", path);
+        goto error;
+    }
+    font->nglyphs = FONT_LE16(header + 6);
+    font->height = FONT_LE16(header + 8);
+    font->missing = FONT_LE16(header + 10);
+    font->atlas_w = FONT_LE16(header + 12);
+    font->atlas_h = FONT_LE16(header + 14);
+    font->atlas_pitch = (font->atlas_w + 7) / 8;
+    if ( (font->nglyphs == 0) || (font->missing >= font->nglyphs) ) {
+        fprintf(stderr, "%s has no glyphs\n", path);
+        goto error;
+    }
+
+    font->glyphs = (loki_glyph *)malloc(font->nglyphs * sizeof(*glyph));
+    size = font->atlas_pitch * font->atlas_h;
+    font->atlas = (unsigned char *)malloc(size ? size : 1);
+    if ( ! font->glyphs || ! font->atlas ) {
+        goto error;
+    }
+    for ( i = 0; i < font->nglyphs; ++i ) {
+        if ( fread(record, sizeof(record), 1, fp) != 1 ) {
+            fprintf(stderr, "%s is truncated\n", path);
+            goto error;
+        }
+        glyph = &font->glyphs[i];
+        glyph->x = FONT_LE16(record + 4);
+        glyph->y = FONT_LE16(record + 6);
+        glyph->w = record[8];
+        glyph->h = record[9];
+        glyph->xoff = (signed char)record[10];
+        glyph->yoff = (signed char)record[11];
+        glyph->advance = record[12];
+        if ( (glyph->x % 8) || (glyph->x + glyph->w > font->atlas_w) ||
+             (glyph->y + glyph->h > font->atlas_h) ) {
+            fprintf(stderr, "%s has a glyph outside the atlas\n", path);
+            goto error;
+        }
+        if ( loki_font_addchar(font, FONT_LE32(record), i) < 0 ) {
+            goto error;
+        }
+    }
+    if ( size && (fread(font->atlas, size, 1, fp) != 1) ) {
+        fprintf(stderr, "%s is truncated\n", path);
+        goto error;
+    }
+    fclose(fp);
+    return font;
+
+error:
+    fclose(fp);
+    loki_font_free(font);
+    return NULL;
+}
+
+unsigned int loki_font_nextchar(const char **str)
+{
+    const unsigned char *s = (const unsigned char *)*str;
+    unsigned int ch, min = 0;
+    int len, i;
+
+    ch = *s;
+    if ( ch < 0x80 ) {
+        len = 0;
+    } else if ( (ch & 0xE0) == 0xC0 ) {
+        len = 1;
+        ch &= 0x1F;
+        min = 0x80;
+    } else if ( (ch & 0xF0) == 0xE0 ) {
+        len = 2;
+        ch &= 0x0F;
+        min = 0x800;
+    } else if ( (ch & 0xF8) == 0xF0 ) {
+        len = 3;
+        ch &= 0x07;
+        min = 0x10000;
+    } else {
+        len = -1;
+    }
+    for ( i = 1; i <= len; ++i ) {
+        if ( (s[i] & 0xC0) != 0x80 ) {
+            len = -1;
+            break;
+        }
+        ch = (ch << 6) | (s[i] & 0x3F);
+    }
+    /* Anything that isn't valid UTF-8 is taken as Latin-1 */
+    if ( (len < 0) || ((len > 0) && ((ch < min) || (ch > 0x10FFFF))) ) {
+        *str += 1;
+        return *s;
+    }
+    *str += len + 1;
+    return ch;
+}
+
+const loki_glyph *loki_font_glyph(const loki_font *font, unsigned int ch)
+{
+    const unsigned short *page;
+
+    if ( ch <= 0xFFFF ) {
+        page = font->pages[ch >> 8];
+        if ( page && page[ch & 0xFF] ) {
+            return &font->glyphs[page[ch & 0xFF] - 1];
+        }
+    }
+    return &font->glyphs[font->missing];
+}
+
+int loki_font_textwidth(const loki_font *font, const char *str, int len)
+{
+    const char *end = str + len;
+    int width = 0;
+
+    while ( str < end ) {
+        width += loki_font_glyph(font, loki_font_nextchar(&str))->advance;
+    }
+    return width;
+}
+
+/* Lines are broken after the last word that fits, and the spaces there
+   are dropped.  A word too long for a line of its own is broken between
+   characters.  'brk' is the end of the last word on the line that has a
+   space after it, and 'word' is where the word after it starts.
+ */
+int loki_font_wraptext(const loki_font *font, const char *text, int width,
+                       loki_textline *lines, int maxlines)
+{
+    const char *start, *brk, *word, *s, *p;
+    int count, w, brkw, wordw, space, advance;
+    unsigned int ch;
+
+    count = 0;
+    s = text;
+    for ( ;; ) {
+        start = s;
+        brk = NULL;
+        word = s;
+        w = brkw = wordw = 0;
+        space = 0;
+        while ( *s && (*s != '\n') ) {
+            p = s;
+            ch = loki_font_nextchar(&s);
+            advance = loki_font_glyph(font, ch)->advance;
+            if ( ch == ' ' ) {
+                if ( ! space && (p > start) ) {
+                    brk = p;
+                    brkw = w;
+                }
+                space = 1;
+                w += advance;
+                continue;
+            }
+            if ( space ) {
+                space = 0;
+                word = p;
+                wordw = 0;
+            }
+            if ( (w + advance > width) && brk ) {
+                if ( count < maxlines ) {
+                    lines[count].text = start;
+                    lines[count].len = brk - start;
+                    lines[count].width = brkw;
+                }
+                ++count;
+                start = word;
+                brk = NULL;
+                w = wordw;
+            }
+            if ( (w + advance > width) && (p > start) ) {
+                if ( count < maxlines ) {
+                    lines[count].text = start;
+                    lines[count].len = p - start;
+                    lines[count].width = w;
+                }
+                ++count;
+                start = word = p;
+                w = wordw = 0;
+            }
+            w += advance;
+            wordw += advance;
+        }
+
+        /* Trailing spaces are left off the line */
+        if ( space ) {
+            if ( brk ) {
+                w = brkw;
+            } else {
+                brk = start;
+                w = 0;
+            }
+        } else {
+            brk = s;
+        }
+        if ( count < maxlines ) {
+            lines[count].text = start;
+            lines[count].len = brk - start;
+            lines[count].width = w;
+        }
+        ++count;
+
+        /* A newline at the very end doesn't start another line */
+        if ( ! *s || ! s[1] ) {
+            break;
+        }
+        ++s;
+    }
+    return count;
+}
@@ -0,0 +1,97 @@
+/*
+    Loki Game Utility Functions
+    Copyright (C) 1999  Loki Entertainment Software
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Bitmap fonts for the 2D and OpenGL message code.
+
+   The glyphs are kept in one 1-bit atlas, and each one has its own size,
+   offset and advance.  Strings are UTF-8, and bytes which aren't part of
+   a valid UTF-8 sequence are taken as Latin-1.
+
+   Font files are made from BDF fonts with the bdf2lfnt tool.
+ */
+
+#ifndef _LOKI_FONT_H_
+#define _LOKI_FONT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    unsigned short x, y;        /* The top left corner in the atlas */
+    unsigned char w, h;
+    signed char xoff;           /* From the pen position to the bitmap */
+    signed char yoff;           /* From the top of the line to the bitmap */
+    unsigned char advance;
+} loki_glyph;
+
+typedef struct {
+    int height;                 /* The distance between lines */
+    int nglyphs;
+    loki_glyph *glyphs;
+    int missing;                /* Used for characters not in the font */
+
+    /* The atlas has 1 bit per pixel, the leftmost in the top bit of each
+       byte, and the top row first.  Glyphs start on a byte boundary, and
+       the rest of their last byte in each row is blank.
+     */
+    int atlas_w, atlas_h, atlas_pitch;
+    unsigned char *atlas;
+
+    /* The glyph index + 1 for each character, 256 characters per page */
+    unsigned short *pages[256];
+} loki_font;
+
+/* A line of laid out text, which points into the original string */
+typedef struct {
+    const char *text;
+    int len;                    /* The length in bytes */
+    int width;                  /* The width in pixels, before scaling */
+} loki_textline;
+
+/* Load a font made by bdf2lfnt, returns NULL if failed */
+loki_font *loki_font_load(const char *path);
+
+/* Return the built-in 8x8 font, which needs no freeing */
+loki_font *loki_font_default(void);
+
+void loki_font_free(loki_font *font);
+
+/* Return the next character in a string, and move past it */
+unsigned int loki_font_nextchar(const char **str);
+
+/* Return the glyph for a character */
+const loki_glyph *loki_font_glyph(const loki_font *font, unsigned int ch);
+
+/* Return the width of the first 'len' bytes of a string in pixels,
+   before scaling */
+int loki_font_textwidth(const loki_font *font, const char *str, int len);
+
+/* Break text into lines no wider than 'width' pixels before scaling,
+   at spaces where possible and at newlines.  Up to 'maxlines' lines are
+   stored, and the number of lines the text needs is returned.
+ */
+int loki_font_wraptext(const loki_font *font, const char *text, int width,
+                       loki_textline *lines, int maxlines);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LOKI_FONT_H_ */
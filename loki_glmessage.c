@@ -66,6 +66,7 @@
 #include <unistd.h>
 #include <GL/gl.h>
 #include "loki_glmessage.h"
+#include "loki_font.h"
 #include "SDL.h"
 
 #ifdef STANDALONE
@@ -76,31 +77,34 @@
 #error You defined LOKI_NO_GLMSG, and are trying to compile GLmsg support!
 #endif
 
-extern unsigned char loki_fontchars[][8];
-
-static int texty = 0;
+static int texttop = 0;
 
 struct loki_glmsg_funcs
 {
     void (*glPixelStorei)( GLenum pname, GLint param );
-    GLuint (*glGenLists)( GLsizei range );
-    void (*glNewList)( GLuint list, GLenum mode );
-    void (*glEndList)( void );
-    void (*glCallLists)( GLsizei n, GLenum type,
-                                     const GLvoid *lists );
-    void (*glListBase)( GLuint base );
-    void (*glBitmap)( GLsizei width, GLsizei height,
-                                    GLfloat xorig, GLfloat yorig,
-                                    GLfloat xmove, GLfloat ymove,
-                                    const GLubyte *bitmap );
+    void (*glGenTextures)( GLsizei n, GLuint *textures );
+    void (*glDeleteTextures)( GLsizei n, const GLuint *textures );
+    void (*glBindTexture)( GLenum target, GLuint texture );
+    void (*glTexImage2D)( GLenum target, GLint level, GLint internalFormat,
+                          GLsizei width, GLsizei height, GLint border,
+                          GLenum format, GLenum type, const GLvoid *pixels );
+    void (*glTexParameteri)( GLenum target, GLenum pname, GLint param );
+    void (*glTexEnvi)( GLenum target, GLenum pname, GLint param );
+    void (*glAlphaFunc)( GLenum func, GLclampf ref );
+    void (*glVertexPointer)( GLint size, GLenum type,
+                             GLsizei stride, const GLvoid *ptr );
+    void (*glTexCoordPointer)( GLint size, GLenum type,
+                               GLsizei stride, const GLvoid *ptr );
+    void (*glDrawArrays)( GLenum mode, GLint first, GLsizei count );
     void (*glPushAttrib)( GLbitfield mask );
     void (*glPopAttrib)( void );
+    void (*glPushClientAttrib)( GLbitfield mask );
+    void (*glPopClientAttrib)( void );
     void (*glShadeModel)( GLenum mode );
     void (*glClear)( GLbitfield mask );
     void (*glClearColor)(GLclampf r, GLclampf g, GLclampf b, GLclampf alpha );
     void (*glColor4f)( GLfloat red, GLfloat green,
                                    GLfloat blue, GLfloat alpha );
-    void (*glRasterPos2i)( GLint x, GLint y );
     void (*glFlush)( void );
     void (*glViewport)( GLint x, GLint y, GLsizei width, GLsizei height );
     void (*glMatrixMode)( GLenum mode );
@@ -108,71 +112,430 @@ struct loki_glmsg_funcs
     void (*glOrtho)( GLdouble left, GLdouble right,
                      GLdouble bottom, GLdouble top,
                      GLdouble near_val, GLdouble far_val );
+    void (*glEnable)( GLenum cap );
     void (*glDisable)( GLenum cap );
+    void (*glEnableClientState)( GLenum cap );
     void (*glDisableClientState)( GLenum cap );
 };
 
-static int font_is_made = 0;
-static GLuint fontOffset;
+/*
+ * The font atlas is kept in one texture, with the set pixels opaque.
+ *  A string is drawn as a single vertex array of textured quads, one
+ *  per visible character.
+ */
+#define MAX_FONT_SCALE 8
+
+static loki_font *msg_font = NULL;
+static int msg_scale = 1;
+static GLuint fontTexture = 0;
+static int font_tex_w;
+static int font_tex_h;
+
+/*
+ * The entry points and the font texture belong to a GL context, and a
+ *  mode switch can replace it.  Each context gets a new generation, and
+ *  whatever was made for an older one is made again when next needed.
+ *  The objects of a dead context went with it, so they aren't deleted.
+ */
+static Uint32 context_generation = 1;
+static Uint32 funcs_generation = 0;
+static Uint32 font_generation = 0;
+
+#ifdef unix
+static void *(*glmsg_glXGetCurrentContext)(void) = NULL;
+static void *current_context = NULL;
+#endif
+
+/* Each character is 4 vertices of (s, t, x, y). */
+#define FLOATS_PER_CHAR 16
+
+static GLfloat *vertex_data = NULL;
+static int vertex_chars = 0;
+
+/*
+ * The quads built for recently drawn strings are kept, so text that
+ *  doesn't change between frames is just drawn again.  The runs are in
+ *  most recently used order, and the last one is dropped when full.
+ */
+#define MAX_CACHED_RUNS 64
+
+typedef struct loki_glmsg_run
+{
+    Uint32 hash;
+    int x;
+    int y;
+    GLfloat r, g, b;
+    char *str;
+    int len;
+    GLfloat *vertices;
+    int quads;
+    struct loki_glmsg_run *prev;
+    struct loki_glmsg_run *next;
+} loki_glmsg_run;
+
+static loki_glmsg_run *runs_head = NULL;
+static loki_glmsg_run *runs_tail = NULL;
+static int runs_count = 0;
 
 static struct loki_glmsg_funcs glfns;
 
 
-static void loki_glmsg_internal_makeRasterFont(void)
+static void loki_glmsg_internal_flushRuns(void);
+
+void loki_glmsg_setfont(loki_font *font, int scale)
+{
+    if (scale < 1)
+        scale = 1;
+    else if (scale > MAX_FONT_SCALE)
+        scale = MAX_FONT_SCALE;
+
+    msg_font = font;
+    msg_scale = scale;
+    font_generation = 0;
+    loki_glmsg_internal_flushRuns();
+}
+
+
+const loki_font *loki_glmsg_getfont(int *scale)
+{
+    if (scale != NULL)
+        *scale = msg_scale;
+
+    return(msg_font ? msg_font : loki_font_default());
+}
+
+
+static void loki_glmsg_internal_makeTextureFont(void)
+{
+    const loki_font *font = msg_font ? msg_font : loki_font_default();
+    GLubyte *texels;
+    const unsigned char *bits;
+    int x, y;
+
+    if (font_generation == context_generation)
+        return;
+
+    /* Old OpenGL wants the texture sides to be powers of two. */
+    for (font_tex_w = 1; font_tex_w < font->atlas_w; font_tex_w *= 2)
+        ;
+    for (font_tex_h = 1; font_tex_h < font->atlas_h; font_tex_h *= 2)
+        ;
+
+    texels = (GLubyte *) calloc(font_tex_w, font_tex_h);
+    if (texels == NULL)
+        return;
+
+    for (y = 0; y < font->atlas_h; y++)
+    {
+        bits = font->atlas + (y * font->atlas_pitch);
+        for (x = 0; x < font->atlas_w; x++)
+        {
+            if (bits[x >> 3] & (0x80 >> (x & 7)))
+                texels[(y * font_tex_w) + x] = 0xFF;
+        } // for
+    } // for
+
+    if (fontTexture)
+        glfns.glDeleteTextures(1, &fontTexture);
+
+    glfns.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glfns.glGenTextures(1, &fontTexture);
+    glfns.glBindTexture(GL_TEXTURE_2D, fontTexture);
+    glfns.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glfns.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glfns.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glfns.glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glfns.glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, font_tex_w, font_tex_h, 0,
+                       GL_ALPHA, GL_UNSIGNED_BYTE, texels);
+    free(texels);
+    font_generation = context_generation;
+}
+
+
+/*
+ * Fill in the quads for len bytes of a string, with the top of the line at y.
+ *  Blank characters don't get a quad.
+ *
+ *  returns the number of quads, or -1 if out of memory.
+ */
+static int loki_glmsg_internal_buildString(int x, int y, const char *s,
+                                           int len)
+{
+    const char *end = s + len;
+    const loki_font *font = msg_font ? msg_font : loki_font_default();
+    const loki_glyph *glyph;
+    int scale = msg_scale;
+    GLfloat *v;
+    GLfloat s0, t0, s1, t1;
+    GLfloat x0, y0, x1, y1;
+    int quads = 0;
+
+    if (len > vertex_chars)
+    {
+        v = (GLfloat *) realloc(vertex_data,
+                                len * FLOATS_PER_CHAR * sizeof (GLfloat));
+        if (v == NULL)
+            return(-1);
+        vertex_data = v;
+        vertex_chars = len;
+    } // if
+
+    v = vertex_data;
+    while (s < end)
+    {
+        glyph = loki_font_glyph(font, loki_font_nextchar(&s));
+        x0 = x + (glyph->xoff * scale);
+        y1 = y - (glyph->yoff * scale);
+        x += glyph->advance * scale;
+        if ((glyph->w == 0) || (glyph->h == 0))
+            continue;
+
+        x1 = x0 + (glyph->w * scale);
+        y0 = y1 - (glyph->h * scale);
+
+        /* The atlas has its top row first, so t grows downwards. */
+        s0 = (GLfloat) glyph->x / font_tex_w;
+        t0 = (GLfloat) glyph->y / font_tex_h;
+        s1 = (GLfloat) (glyph->x + glyph->w) / font_tex_w;
+        t1 = (GLfloat) (glyph->y + glyph->h) / font_tex_h;
+
+        *v++ = s0; *v++ = t1; *v++ = x0; *v++ = y0;
+        *v++ = s1; *v++ = t1; *v++ = x1; *v++ = y0;
+        *v++ = s1; *v++ = t0; *v++ = x1; *v++ = y1;
+        *v++ = s0; *v++ = t0; *v++ = x0; *v++ = y1;
+        quads++;
+    } // while
+
+    return(quads);
+}
+
+
+static void loki_glmsg_internal_drawQuads(const GLfloat *v, int quads)
+{
+    const GLsizei stride = 4 * sizeof (GLfloat);
+
+    if (quads <= 0)
+        return;
+
+    glfns.glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT);
+    glfns.glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+
+    glfns.glEnable(GL_TEXTURE_2D);
+    glfns.glBindTexture(GL_TEXTURE_2D, fontTexture);
+    glfns.glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+    glfns.glEnable(GL_ALPHA_TEST);
+    glfns.glAlphaFunc(GL_GREATER, 0.5f);
+
+    glfns.glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glfns.glEnableClientState(GL_VERTEX_ARRAY);
+    glfns.glTexCoordPointer(2, GL_FLOAT, stride, v);
+    glfns.glVertexPointer(2, GL_FLOAT, stride, v + 2);
+    glfns.glDrawArrays(GL_QUADS, 0, quads * 4);
+
+    glfns.glPopClientAttrib();
+    glfns.glPopAttrib();
+}
+
+
+static Uint32 loki_glmsg_internal_hashRun(int x, int y, const char *str,
+                                          int len)
+{
+    Uint32 hash = 5381;
+    int i;
+
+    hash = (hash * 33) ^ (Uint32) x;
+    hash = (hash * 33) ^ (Uint32) y;
+    for (i = 0; i < len; i++)
+        hash = (hash * 33) ^ (unsigned char) str[i];
+
+    return(hash);
+}
+
+
+static void loki_glmsg_internal_flushRuns(void)
+{
+    loki_glmsg_run *run;
+
+    while ((run = runs_head) != NULL)
+    {
+        runs_head = run->next;
+        free(run);
+    } // while
+
+    runs_tail = NULL;
+    runs_count = 0;
+}
+
+
+static void loki_glmsg_internal_unlinkRun(loki_glmsg_run *run)
 {
-   GLuint i;
-
-   if (!font_is_made)
-   {
-       glfns.glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-
-       fontOffset = glfns.glGenLists (128);
-       for (i = 0; i < 128; i++) {
-           glfns.glNewList(fontOffset + i, GL_COMPILE);
-           glfns.glColor4f(0.0, 1.0, 0.0, 1.0);
-           glfns.glBitmap(8, 8, 0.0, 2.0, 10.0, 0.0, loki_fontchars[i]);
-           glfns.glEndList();
-       }
-       font_is_made = 1;
-   }
+    if (run->prev)
+        run->prev->next = run->next;
+    else
+        runs_head = run->next;
+
+    if (run->next)
+        run->next->prev = run->prev;
+    else
+        runs_tail = run->prev;
 }
 
-static void loki_glmsg_internal_printString(const char *s)
+
+static void loki_glmsg_internal_linkRun(loki_glmsg_run *run)
+{
+    run->prev = NULL;
+    run->next = runs_head;
+    if (runs_head)
+        runs_head->prev = run;
+    else
+        runs_tail = run;
+    runs_head = run;
+}
+
+
+/*
+ * Find the quads for a string, building and caching them if needed.
+ *
+ *  returns NULL if there isn't memory to build or cache the string.
+ */
+static loki_glmsg_run *loki_glmsg_internal_getRun(int x, int y,
+                                                  GLfloat r, GLfloat g,
+                                                  GLfloat b, const char *str,
+                                                  int len)
 {
-   glfns.glPushAttrib(GL_LIST_BIT);
-   glfns.glListBase(fontOffset);
-   glfns.glCallLists((GLsizei) strlen(s), GL_UNSIGNED_BYTE, (GLubyte *) s);
-   glfns.glPopAttrib();
+    Uint32 hash = loki_glmsg_internal_hashRun(x, y, str, len);
+    loki_glmsg_run *run;
+    int quads;
+
+    for (run = runs_head; run != NULL; run = run->next)
+    {
+        if ((run->hash == hash) && (run->x == x) && (run->y == y) &&
+            (run->r == r) && (run->g == g) && (run->b == b) &&
+            (run->len == len) && (memcmp(run->str, str, len) == 0))
+        {
+            if (run != runs_head)
+            {
+                loki_glmsg_internal_unlinkRun(run);
+                loki_glmsg_internal_linkRun(run);
+            } // if
+            return(run);
+        } // if
+    } // for
+
+    quads = loki_glmsg_internal_buildString(x, y, str, len);
+    if (quads < 0)
+        return(NULL);
+
+    if (runs_count == MAX_CACHED_RUNS)
+    {
+        run = runs_tail;
+        loki_glmsg_internal_unlinkRun(run);
+        free(run);
+        runs_count--;
+    } // if
+
+    /* The vertices and the string are kept in the same block. */
+    run = (loki_glmsg_run *) malloc(sizeof (*run) +
+                                    quads * FLOATS_PER_CHAR * sizeof (GLfloat) +
+                                    len);
+    if (run == NULL)
+        return(NULL);
+
+    run->hash = hash;
+    run->x = x;
+    run->y = y;
+    run->r = r;
+    run->g = g;
+    run->b = b;
+    run->quads = quads;
+    run->vertices = (GLfloat *) (run + 1);
+    memcpy(run->vertices, vertex_data,
+           quads * FLOATS_PER_CHAR * sizeof (GLfloat));
+    run->str = (char *) (run->vertices + quads * FLOATS_PER_CHAR);
+    run->len = len;
+    memcpy(run->str, str, len);
+
+    loki_glmsg_internal_linkRun(run);
+    runs_count++;
+    return(run);
 }
 
 
 void loki_glmsg_internal_initfuncs(void)
 {
     glfns.glPixelStorei  = SDL_GL_GetProcAddress("glPixelStorei");
-    glfns.glGenLists     = SDL_GL_GetProcAddress("glGenLists");
-    glfns.glNewList      = SDL_GL_GetProcAddress("glNewList");
-    glfns.glEndList      = SDL_GL_GetProcAddress("glEndList");
-    glfns.glCallLists    = SDL_GL_GetProcAddress("glCallLists");
-    glfns.glListBase     = SDL_GL_GetProcAddress("glListBase");
-    glfns.glBitmap       = SDL_GL_GetProcAddress("glBitmap");
+    glfns.glGenTextures  = SDL_GL_GetProcAddress("glGenTextures");
+    glfns.glDeleteTextures = SDL_GL_GetProcAddress("glDeleteTextures");
+    glfns.glBindTexture  = SDL_GL_GetProcAddress("glBindTexture");
+    glfns.glTexImage2D   = SDL_GL_GetProcAddress("glTexImage2D");
+    glfns.glTexParameteri = SDL_GL_GetProcAddress("glTexParameteri");
+    glfns.glTexEnvi      = SDL_GL_GetProcAddress("glTexEnvi");
+    glfns.glAlphaFunc    = SDL_GL_GetProcAddress("glAlphaFunc");
+    glfns.glVertexPointer = SDL_GL_GetProcAddress("glVertexPointer");
+    glfns.glTexCoordPointer = SDL_GL_GetProcAddress("glTexCoordPointer");
+    glfns.glDrawArrays   = SDL_GL_GetProcAddress("glDrawArrays");
     glfns.glPushAttrib   = SDL_GL_GetProcAddress("glPushAttrib");
     glfns.glPopAttrib    = SDL_GL_GetProcAddress("glPopAttrib");
+    glfns.glPushClientAttrib = SDL_GL_GetProcAddress("glPushClientAttrib");
+    glfns.glPopClientAttrib = SDL_GL_GetProcAddress("glPopClientAttrib");
     glfns.glShadeModel   = SDL_GL_GetProcAddress("glShadeModel");
     glfns.glClear        = SDL_GL_GetProcAddress("glClear");
     glfns.glClearColor   = SDL_GL_GetProcAddress("glClearColor");
     glfns.glColor4f      = SDL_GL_GetProcAddress("glColor4f");
-    glfns.glRasterPos2i  = SDL_GL_GetProcAddress("glRasterPos2i");
     glfns.glFlush        = SDL_GL_GetProcAddress("glFlush");
     glfns.glViewport     = SDL_GL_GetProcAddress("glViewport");
     glfns.glMatrixMode   = SDL_GL_GetProcAddress("glMatrixMode");
     glfns.glLoadIdentity = SDL_GL_GetProcAddress("glLoadIdentity");
     glfns.glOrtho        = SDL_GL_GetProcAddress("glOrtho");
+    glfns.glEnable       = SDL_GL_GetProcAddress("glEnable");
     glfns.glDisable      = SDL_GL_GetProcAddress("glDisable");
+    glfns.glEnableClientState = SDL_GL_GetProcAddress("glEnableClientState");
     glfns.glDisableClientState = SDL_GL_GetProcAddress("glDisableClientState");
 }
 
 
+void loki_glmsg_newcontext(void)
+{
+    context_generation++;
+    fontTexture = 0;
+}
+
+
+/*
+ * Start a new generation if the context has changed, and look up the
+ *  entry points once for each one.  The GL library may have been loaded
+ *  again since the last generation, so glXGetCurrentContext is looked up
+ *  with the rest.
+ */
+static void loki_glmsg_internal_checkContext(void)
+{
+#ifdef unix
+    if ((funcs_generation == context_generation) &&
+        (glmsg_glXGetCurrentContext != NULL) &&
+        (glmsg_glXGetCurrentContext() != current_context))
+    {
+        loki_glmsg_newcontext();
+    } // if
+#endif
+
+    if (funcs_generation != context_generation)
+    {
+        loki_glmsg_internal_initfuncs();
+#ifdef unix
+        glmsg_glXGetCurrentContext =
+                            SDL_GL_GetProcAddress("glXGetCurrentContext");
+        current_context = NULL;
+        if (glmsg_glXGetCurrentContext != NULL)
+            current_context = glmsg_glXGetCurrentContext();
+#endif
+        funcs_generation = context_generation;
+    } // if
+}
+
+
 /*
+ * This is called after each mode set, and a new context can have the
+ *  address of the old one, so always start a new generation here.
  *
  *  returns -1 on error, 0 on success.
  */
@@ -182,9 +545,10 @@ int loki_glmsg_initialize(GLfloat bgr, GLfloat bgg, GLfloat bgb)
     int w = surface->w;
     int h = surface->h;
 
-    texty = h - 15;  /* 13 pixels high, and 2 pixels buffer. */
+    texttop = h - 9;
 
-    loki_glmsg_internal_initfuncs();
+    loki_glmsg_newcontext();
+    loki_glmsg_internal_checkContext();
 
    // glfns.glBlendColor(0.0f, 0.0f, 0.0f, 0.0f);
    // glfns.glBlendFunc( GL_ONE, GL_ZERO  );
@@ -214,7 +578,7 @@ int loki_glmsg_initialize(GLfloat bgr, GLfloat bgg, GLfloat bgb)
     glfns.glMatrixMode(GL_MODELVIEW);
     glfns.glLoadIdentity();
 
-    loki_glmsg_internal_makeRasterFont();
+    loki_glmsg_internal_makeTextureFont();
 
     glfns.glClearColor(1.0, bgg, bgb, 0.0);
     glfns.glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -223,28 +587,50 @@ int loki_glmsg_initialize(GLfloat bgr, GLfloat bgg, GLfloat bgb)
 }
 
 
-void loki_glmsg_print(GLfloat r, GLfloat g, GLfloat b, const char *str)
+/*
+ * Center the first len bytes of str on the next line of the screen.
+ */
+void loki_glmsg_printline(GLfloat r, GLfloat g, GLfloat b,
+                          const char *str, int len)
 {
     SDL_Surface *surface = SDL_GetVideoSurface();
-    int textw = ((int) surface->w - ((int) (strlen(str) * 10))) / 2;
+    const loki_font *font = msg_font ? msg_font : loki_font_default();
+    int textw = ((int) surface->w -
+                 (loki_font_textwidth(font, str, len) * msg_scale)) / 2;
+    int lineheight = font->height * msg_scale;
+    loki_glmsg_run *run;
 
     #ifdef STANDALONE
         printf("loki_glmsg_print(): Should write this to the frame buffer:\n"
-               "\"%s\"\n", str);
+               "\"%.*s\"\n", len, str);
     #endif
 
+    loki_glmsg_internal_checkContext();
+    loki_glmsg_internal_makeTextureFont();
     glfns.glColor4f(r, g, b, 1.0);
-    glfns.glRasterPos2i(textw, texty);
-    loki_glmsg_internal_printString(str);
+    run = loki_glmsg_internal_getRun(textw, texttop, r, g, b, str, len);
+    if (run != NULL)
+        loki_glmsg_internal_drawQuads(run->vertices, run->quads);
+    else
+    {
+        loki_glmsg_internal_drawQuads(vertex_data,
+                    loki_glmsg_internal_buildString(textw, texttop, str, len));
+    } // else
 
-    texty -= 15;
-    if (texty <= 0)
-        texty = surface->h - 15;
+    texttop -= lineheight;
+    if (texttop - lineheight < 0)
+        texttop = surface->h - 9;
 
     glfns.glFlush ();
 }
 
 
+void loki_glmsg_print(GLfloat r, GLfloat g, GLfloat b, const char *str)
+{
+    loki_glmsg_printline(r, g, b, str, strlen(str));
+}
+
+
 #ifdef STANDALONE  // for testing only.  --ryan.
 static inline void do_delay(int ms)
 {
@@ -21,6 +21,7 @@
 #define _LOKI_GLMESSAGE_H
 
 #include <GL/gl.h>
+#include "loki_font.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -30,8 +31,33 @@ extern "C" {
 #error You defined LOKI_NO_GLMSG, and included loki_glmessage.h!
 #endif
 
+/*
+ * Call this after each mode set, before printing.  The font and the
+ *  OpenGL entry points are made again for the new context.
+ */
 int loki_glmsg_initialize(GLfloat bgr, GLfloat bgg, GLfloat bgb);
 void loki_glmsg_print(GLfloat r, GLfloat g, GLfloat b, const char *str);
+void loki_glmsg_printline(GLfloat r, GLfloat g, GLfloat b,
+                          const char *str, int len);
+
+/*
+ * Call this when the OpenGL context has been replaced without calling
+ *  loki_glmsg_initialize(), and the font will be made again in the new one.
+ *  Under X11 a change of context is noticed without this, unless the new
+ *  one has the same address.
+ */
+void loki_glmsg_newcontext(void);
+
+/*
+ * Draw with the font, scaled up by a whole number from 1 to 8.
+ *  If font is NULL, the built-in 8x8 font is used.
+ */
+void loki_glmsg_setfont(loki_font *font, int scale);
+
+/*
+ * Return the font being drawn with, and the scale if scale isn't NULL.
+ */
+const loki_font *loki_glmsg_getfont(int *scale);
 
 #ifdef __cplusplus
 }
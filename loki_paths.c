@@ -22,6 +22,8 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/vfs.h>
+#include <sys/sysmacros.h>
+#include <sys/poll.h>
 #include <pwd.h>
 #include <limits.h>
 #include <stdlib.h>
@@ -31,10 +33,20 @@
 #include <string.h>
 #include <mntent.h>
 #include <assert.h>
+#include <errno.h>
+#include <sys/time.h>
 
 /* Prototype header */
 #include "loki_utils.h"
 
+/* These are in loki_filetrace.c */
+extern int loki_filetrace_start_internal(struct timeval *start);
+extern void loki_filetrace_phase_internal(const char *phase,
+                                          const struct timeval *start);
+
+/* This is in loki_files.c */
+extern void loki_forgetdirs_internal(void);
+
 /* A short game name, could be used as argv[0] */
 static char game_name[100] = "";
 static char game_versionstring[100] = "";
@@ -49,9 +61,26 @@ static char datapath[PATH_MAX];
 /* The directory where user preferences can be found (home directory) */
 static char prefpath[PATH_MAX];
 
+/* The lengths of the paths above, so building file paths doesn't rescan them */
+static int cdrompath_len = 0;
+static int datapath_len = 0;
+static int prefpath_len = 0;
+
+/* The preferences and data directories, held open for use with openat() */
+static int prefpath_fd = -1;
+static int datapath_fd = -1;
+
+/* This changes whenever the data or CD-ROM path changes, so that interned
+   data file lookups know they need to be redone.
+ */
+static int path_generation = 1;
+
 /* The function to be called if we prompt for the CD */
 static loki_prompt_func prompt_func = NULL;
 
+/* How long to wait for the CD to be mounted between prompts, in ms */
+static int prompt_wait = 0;
+
 char *loki_gethomedir(void)
 {
     char *home = NULL;
@@ -147,18 +176,30 @@ const char *loki_getgamedescription(void)
 }
 
 
-/* 
-    This function gets the directory containing the running program.
-    argv0 - the 0'th argument to the program
-*/
-void loki_initpaths(char *argv0)
+/* Open a directory for use with the *at() functions, replacing 'oldfd' */
+static int open_pathfd(const char *path, int oldfd)
 {
-    char temppath[PATH_MAX], env[100];
-    char *home, *ptr, *data_env;
+    int fd;
 
-    home = loki_gethomedir();
-    if(*game_name == 0) /* Game name defaults to argv[0] */
-      loki_setgamename(argv0, "0.1", "");
+    if ( oldfd >= 0 ) {
+        /* Directories known under the old fd would match the new one */
+        loki_forgetdirs_internal();
+        close(oldfd);
+    }
+    fd = -1;
+    if ( *path ) {
+        fd = open(path, O_RDONLY|O_DIRECTORY);
+        if ( fd >= 0 ) {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    return fd;
+}
+
+/* Find the directory containing the running program by searching $PATH */
+static void loki_findprogram(const char *argv0, const char *home)
+{
+    char temppath[PATH_MAX];
 
     strcpy(temppath, argv0);  /* If this overflows, it's your own fault :) */
     if ( ! strrchr(temppath, '/') ) {
@@ -198,10 +239,6 @@ void loki_initpaths(char *argv0)
         path = last+1;
 
       } while ( *last && !found );
-
-    } else {
-      /* Increment argv0 to the basename */
-      argv0 = strrchr(argv0, '/')+1;
     }
 
     /* Now canonicalize it to a full pathname for the data path */
@@ -209,6 +246,54 @@ void loki_initpaths(char *argv0)
       /* There should always be '/' in the path */
       *(strrchr(datapath, '/')) = '\0';
     }
+}
+
+/* Create the game preferences directory, and ~/.loki above it if needed */
+static void loki_makeprefdir(char *path)
+{
+    char *sep;
+
+    if ( mkdir(path, 0700) == 0 ) {
+        printf("Creating %s preferences directory: %s\n", game_name, path);
+    } else if ( errno == ENOENT ) {
+        sep = strrchr(path, '/');
+        *sep = '\0';
+        if ( mkdir(path, 0700) == 0 ) {
+            printf("Creating Loki preferences directory: %s\n", path);
+        }
+        *sep = '/';
+        if ( mkdir(path, 0700) == 0 ) {
+            printf("Creating %s preferences directory: %s\n", game_name, path);
+        }
+    }
+}
+
+/* 
+    This function gets the directory containing the running program.
+    argv0 - the 0'th argument to the program
+*/
+void loki_initpaths(char *argv0)
+{
+    char env[100];
+    char *home, *ptr, *data_env;
+    struct timeval start;
+    int tracing, len;
+
+    tracing = loki_filetrace_start_internal(&start);
+
+    home = loki_gethomedir();
+    if(*game_name == 0) /* Game name defaults to argv[0] */
+      loki_setgamename(argv0, "0.1", "");
+
+    /* The kernel already knows where we are, ask it first */
+    len = readlink("/proc/self/exe", datapath, sizeof(datapath)-1);
+    if ( (len > 0) && (datapath[0] == '/') ) {
+      datapath[len] = '\0';
+      *(strrchr(datapath, '/')) = '\0';
+    } else {
+      datapath[0] = '\0';
+      loki_findprogram(argv0, home);
+    }
 
     strcpy(env, game_name);
 
@@ -225,16 +310,23 @@ void loki_initpaths(char *argv0)
     if(data_env)
       strncpy(datapath, data_env, PATH_MAX);
 
-    /* Create the preferences directory, if needed */
+    /* Create the preferences directory, if needed.
+       This is usually a single mkdir() which fails with EEXIST.
+     */
     sprintf(prefpath, "%s/.loki/", home);
-    if ( access(prefpath, W_OK) != 0 ) {
-        printf("Creating Loki preferences directory: %s\n", prefpath);
-        mkdir(prefpath, 0700);
-    }
     strcat(prefpath, game_name);
-    if ( access(prefpath, W_OK) != 0 ) {
-        printf("Creating %s preferences directory: %s\n", game_name, prefpath);
-        mkdir(prefpath, 0700);
+    loki_makeprefdir(prefpath);
+
+    datapath_len = strlen(datapath);
+    prefpath_len = strlen(prefpath);
+    ++path_generation;
+
+    /* Hold the directories open so file lookups can be relative to them */
+    prefpath_fd = open_pathfd(prefpath, prefpath_fd);
+    datapath_fd = open_pathfd(datapath, datapath_fd);
+
+    if ( tracing ) {
+      loki_filetrace_phase_internal("loki_initpaths", &start);
     }
 }
 
@@ -254,6 +346,8 @@ void loki_setcdrompath(const char *path)
 {
     strncpy(cdrompath, path, PATH_MAX);
     cdrompath[PATH_MAX-1] = '\0';
+    cdrompath_len = strlen(cdrompath);
+    ++path_generation;
 }
 
 void  loki_cdpromptfunction (loki_prompt_func func)
@@ -261,6 +355,11 @@ void  loki_cdpromptfunction (loki_prompt_func func)
     prompt_func = func;
 }
 
+void loki_cdpromptwait(int timeout_ms)
+{
+    prompt_wait = (timeout_ms > 0) ? timeout_ms : 0;
+}
+
 char *loki_getprefpath(void)
 {
     return(prefpath);
@@ -276,16 +375,78 @@ char *loki_getcdrompath(void)
     return(cdrompath);
 }
 
-char *loki_getdatafile(const char *file, char *filepath, int maxpath)
+/* These return -1 if the directory couldn't be opened */
+int loki_getprefpathfd_internal(void)
+{
+    return(prefpath_fd);
+}
+
+int loki_getdatapathfd_internal(void)
+{
+    return(datapath_fd);
+}
+
+/* Build "dir/file" into filepath, copying each part only once.
+   Returns the length of the result, or -1 if it had to be truncated.
+ */
+static int loki_joinpath(char *filepath, int maxpath,
+                         const char *dir, int dirlen, const char *file)
+{
+    char *dst, *end;
+
+    if ( maxpath <= 0 ) {
+        return -1;
+    }
+    end = filepath + maxpath - 1;
+    if ( dirlen >= maxpath ) {
+        dirlen = maxpath - 1;
+    }
+    memcpy(filepath, dir, dirlen);
+    dst = filepath + dirlen;
+    if ( dst < end ) {
+        *dst++ = '/';
+        while ( *file && (dst < end) ) {
+            *dst++ = *file++;
+        }
+        if ( ! *file ) {
+            *dst = '\0';
+            return (dst - filepath);
+        }
+    }
+    *dst = '\0';
+    return -1;
+}
+
+int loki_buildpath(const char *dir, const char *file, char *filepath, int maxpath)
 {
-    strncpy(filepath, loki_getdatapath(), maxpath);
-    strncat(filepath, "/", maxpath);
-    strncat(filepath, file, maxpath);
+    return loki_joinpath(filepath, maxpath, dir, strlen(dir), file);
+}
+
+int loki_builddatafile(const char *file, char *filepath, int maxpath)
+{
+    int len;
+
+    len = loki_joinpath(filepath, maxpath, datapath, datapath_len, file);
     if ( (access(filepath, R_OK) != 0) && loki_hascdrompath() ) {
-        strncpy(filepath, loki_getcdrompath(), maxpath);
-        strncat(filepath, "/", maxpath);
-        strncat(filepath, file, maxpath);
+        len = loki_joinpath(filepath, maxpath, cdrompath, cdrompath_len, file);
     }
+    return len;
+}
+
+int loki_buildpreffile(const char *file, char *filepath, int maxpath)
+{
+    return loki_joinpath(filepath, maxpath, prefpath, prefpath_len, file);
+}
+
+int loki_buildcdromfile(const char *file, char *filepath, int maxpath)
+{
+    /* The CDROM path must have been set */
+    return loki_joinpath(filepath, maxpath, cdrompath, cdrompath_len, file);
+}
+
+char *loki_getdatafile(const char *file, char *filepath, int maxpath)
+{
+    loki_builddatafile(file, filepath, maxpath);
     return filepath;
 }
 
@@ -293,16 +454,18 @@ char *loki_promptdatafile(const char *file, char *filepath, int maxpath)
 {
     static int in_prompt = 0;
 
-    strncpy(filepath, loki_getdatapath(), maxpath);
-    strncat(filepath, "/", maxpath);
-    strncat(filepath, file, maxpath);
+    loki_joinpath(filepath, maxpath, datapath, datapath_len, file);
     if ( (access(filepath, R_OK) != 0) && loki_hascdrompath() ) {
-        strncpy(filepath, loki_getcdrompath(), maxpath);
-        strncat(filepath, "/", maxpath);
-        strncat(filepath, file, maxpath);
+        loki_joinpath(filepath, maxpath, cdrompath, cdrompath_len, file);
         if ( (access(filepath, R_OK) != 0) && prompt_func && !in_prompt ) {
             in_prompt = 1;
-            while(! (*prompt_func)(file) );
+            /* See if the CD has shown up before prompting again */
+            while ( ! (*prompt_func)(file) ) {
+                if ( loki_waitdatafile(file, prompt_wait) ) {
+                    loki_builddatafile(file, filepath, maxpath);
+                    break;
+                }
+            }
             in_prompt = 0;
         }
     }
@@ -311,21 +474,120 @@ char *loki_promptdatafile(const char *file, char *filepath, int maxpath)
 
 char *loki_getpreffile(const char *file, char *filepath, int maxpath)
 {
-    strncpy(filepath, loki_getprefpath(), maxpath);
-    strncat(filepath, "/", maxpath);
-    strncat(filepath, file, maxpath);
+    loki_buildpreffile(file, filepath, maxpath);
     return filepath;
 }
 
 char *loki_getcdromfile(const char *file, char *filepath, int maxpath)
 {
-    /* The CDROM path must have been set */
-    strncpy(filepath, loki_getcdrompath(), maxpath);
-    strncat(filepath, "/", maxpath);
-    strncat(filepath, file, maxpath);
+    loki_buildcdromfile(file, filepath, maxpath);
     return filepath;
 }
 
+/* The interned data files, a hash table of names to resolved paths */
+#define DATAFILE_HASH   1024
+
+struct loki_datafile {
+    char *file;
+    char *path;
+    int exists;
+    int generation;
+    struct loki_datafile *next;
+};
+
+static loki_datafile *datafile_table[DATAFILE_HASH];
+
+static unsigned int loki_hashname(const char *str)
+{
+    unsigned int hash = 0;
+
+    while ( *str ) {
+        hash = (hash * 31) + (unsigned char)*str++;
+    }
+    return hash % DATAFILE_HASH;
+}
+
+/* Look up the data file again if the paths have changed since last time.
+   A file that wasn't found is looked for every time, since the CD may
+   have been inserted or the file installed since.
+ */
+static void loki_resolvedatafile(loki_datafile *handle)
+{
+    char filepath[PATH_MAX];
+    int len, exists;
+    char *path;
+
+    if ( (handle->generation == path_generation) && handle->exists ) {
+        return;
+    }
+    len = loki_joinpath(filepath, sizeof(filepath),
+                        datapath, datapath_len, handle->file);
+    exists = (access(filepath, R_OK) == 0);
+    if ( ! exists && loki_hascdrompath() ) {
+        len = loki_joinpath(filepath, sizeof(filepath),
+                            cdrompath, cdrompath_len, handle->file);
+        exists = (access(filepath, R_OK) == 0);
+    }
+    if ( len < 0 ) {
+        len = strlen(filepath);
+    }
+    /* Keep the path returned before, unless it has moved */
+    if ( ! handle->path || (strcmp(handle->path, filepath) != 0) ) {
+        path = (char *)realloc(handle->path, len+1);
+        if ( ! path ) {
+            return;
+        }
+        memcpy(path, filepath, len+1);
+        handle->path = path;
+    }
+    handle->exists = exists;
+    handle->generation = path_generation;
+}
+
+loki_datafile *loki_interndatafile(const char *file)
+{
+    unsigned int hash;
+    loki_datafile *handle;
+
+    hash = loki_hashname(file);
+    for ( handle = datafile_table[hash]; handle; handle = handle->next ) {
+        if ( strcmp(handle->file, file) == 0 ) {
+            return handle;
+        }
+    }
+    handle = (loki_datafile *)malloc(sizeof *handle);
+    if ( handle ) {
+        handle->file = strdup(file);
+        handle->path = NULL;
+        handle->exists = 0;
+        handle->generation = 0;
+        if ( handle->file ) {
+            loki_resolvedatafile(handle);
+        }
+        if ( !handle->file || !handle->path ) {
+            free(handle->file);
+            free(handle->path);
+            free(handle);
+            return NULL;
+        }
+        handle->next = datafile_table[hash];
+        datafile_table[hash] = handle;
+    }
+    return handle;
+}
+
+const char *loki_datafilepath(loki_datafile *handle)
+{
+    loki_resolvedatafile(handle);
+    return handle->path;
+}
+
+int loki_datafileexists(loki_datafile *handle)
+{
+    loki_resolvedatafile(handle);
+    return handle->exists;
+}
+
 size_t loki_getavailablespace(const char *path)
 {
     struct statfs buf;
@@ -334,8 +596,10 @@ size_t loki_getavailablespace(const char *path)
     return ((long long)buf.f_bsize * buf.f_bavail) / 1024;
 }
 
-/* Code to determine the mount point of a CD-ROM */
-int loki_getmountpoint(const char *device, char *mntpt, int max_size)
+/* Determine the mount point of a device by scanning the mount table.
+   This is used when /proc/self/mountinfo isn't available.
+ */
+static int loki_getmountpoint_mtab(const char *device, char *mntpt, int max_size)
 {
     char devpath[PATH_MAX], mntdevpath[PATH_MAX];
     FILE * mountfp;
@@ -391,6 +655,226 @@ int loki_getmountpoint(const char *device, char *mntpt, int max_size)
     return(mounted);
 }
 
+/* The mount table, cached from /proc/self/mountinfo and keyed by device.
+   The kernel flags the file with POLLPRI whenever the table changes, so it
+   only needs to be read again when that happens.
+ */
+typedef struct {
+    dev_t dev;
+    int root;           /* Whether this is a mount of the filesystem root */
+    const char *dir;
+} mount_entry;
+
+static int mountinfo_fd = -2;
+static char *mountinfo_buf = NULL;
+static mount_entry *mount_table = NULL;
+static int num_mounts = 0;
+
+/* Undo the octal escapes used for spaces and such in mountinfo */
+static void loki_unescapemount(char *str)
+{
+    char *dst;
+
+    for ( dst = str; *str; ++dst ) {
+        if ( (str[0] == '\\') && isdigit(str[1]) &&
+             isdigit(str[2]) && isdigit(str[3]) ) {
+            *dst = ((str[1]-'0') << 6) | ((str[2]-'0') << 3) | (str[3]-'0');
+            str += 4;
+        } else {
+            *dst = *str++;
+        }
+    }
+    *dst = '\0';
+}
+
+/* Parse the mount table in buf, which becomes the cached table.
+   Returns -1 if out of memory, and then the cached table is left alone.
+ */
+static int loki_parsemountinfo(char *buf)
+{
+    char *line, *next, *field[6], *tmp;
+    int i, count, max;
+    unsigned int major, minor;
+    struct stat sb;
+    mount_entry *table, *entry;
+
+    max = 0;
+    for ( tmp = buf; *tmp; ++tmp ) {
+        if ( *tmp == '\n' ) {
+            ++max;
+        }
+    }
+    table = (mount_entry *)malloc((max+1)*sizeof(*table));
+    if ( ! table ) {
+        return -1;
+    }
+
+    count = 0;
+    for ( line = buf; line && *line && (count <= max); line = next ) {
+        next = strchr(line, '\n');
+        if ( next ) {
+            *next++ = '\0';
+        }
+
+        /* ID parent major:minor root mountpoint options ... */
+        for ( i=0; i<6; ++i ) {
+            field[i] = strsep(&line, " ");
+            if ( ! field[i] ) {
+                break;
+            }
+        }
+        if ( (i < 6) || (sscanf(field[2], "%u:%u", &major, &minor) != 2) ) {
+            continue;
+        }
+        entry = &table[count];
+        entry->dev = makedev(major, minor);
+        entry->root = (strcmp(field[3], "/") == 0);
+        entry->dir = field[4];
+        loki_unescapemount(field[4]);
+
+        /* ... - fstype source superoptions */
+        tmp = line ? strstr(line, " - supermount ") : NULL;
+        if ( tmp ) {
+            tmp = strstr(tmp, "dev=");
+            if ( tmp ) {
+                tmp += strlen("dev=");
+                tmp[strcspn(tmp, ", ")] = '\0';
+                if ( stat(tmp, &sb) == 0 ) {
+                    entry->dev = sb.st_rdev;
+                }
+            }
+        }
+        ++count;
+    }
+    free(mount_table);
+    free(mountinfo_buf);
+    mount_table = table;
+    mountinfo_buf = buf;
+    num_mounts = count;
+    return 0;
+}
+
+/* Forget the cached mount table, and open mountinfo again next time */
+static void loki_dropmounts(void)
+{
+    free(mount_table);
+    free(mountinfo_buf);
+    mount_table = NULL;
+    mountinfo_buf = NULL;
+    num_mounts = 0;
+    if ( mountinfo_fd >= 0 ) {
+        close(mountinfo_fd);
+    }
+    mountinfo_fd = -2;
+}
+
+/* Make sure the cached mount table is up to date.
+   Returns -1 if /proc/self/mountinfo isn't available.
+ */
+static int loki_updatemounts(void)
+{
+    struct pollfd pfd;
+    char *buf, *tmp;
+    int size, len, amount;
+
+    if ( mountinfo_fd == -2 ) {
+        mountinfo_fd = open("/proc/self/mountinfo", O_RDONLY);
+        if ( mountinfo_fd < 0 ) {
+            return -1;
+        }
+        fcntl(mountinfo_fd, F_SETFD, FD_CLOEXEC);
+    } else if ( mountinfo_fd < 0 ) {
+        return -1;
+    } else {
+        pfd.fd = mountinfo_fd;
+        pfd.events = POLLPRI;
+        pfd.revents = 0;
+        if ( (poll(&pfd, 1, 0) == 0) ||
+             !(pfd.revents & (POLLPRI|POLLERR)) ) {
+            return 0;
+        }
+    }
+
+    /* Read the whole table.  Reading doesn't clear the change notification,
+       the poll() above did, so a change from now on is flagged again.
+     */
+    size = 4096;
+    len = 0;
+    lseek(mountinfo_fd, 0, SEEK_SET);
+    buf = (char *)malloc(size);
+    while ( buf ) {
+        amount = read(mountinfo_fd, buf+len, size-len-1);
+        if ( amount <= 0 ) {
+            break;
+        }
+        len += amount;
+        if ( len == (size-1) ) {
+            size *= 2;
+            tmp = (char *)realloc(buf, size);
+            if ( ! tmp ) {
+                free(buf);
+            }
+            buf = tmp;
+        }
+    }
+    if ( buf ) {
+        buf[len] = '\0';
+        if ( loki_parsemountinfo(buf) == 0 ) {
+            return 0;
+        }
+        free(buf);
+    }
+
+    /* The poll() used up the change notification, so the old table can't
+       be trusted.  Try again next time.
+     */
+    loki_dropmounts();
+    return -1;
+}
+
+/* Code to determine the mount point of a CD-ROM */
+int loki_getmountpoint(const char *device, char *mntpt, int max_size)
+{
+    struct stat sb;
+    const char *dir;
+    int i, mounted;
+
+    /* Nothing to do with no device file */
+    if( device == NULL ){
+        *mntpt = '\0';
+        return -1;
+    }
+
+    /* Get the device number of the CD-ROM device */
+    if ( stat(device, &sb) < 0 ) {
+        perror("stat() on your CD-ROM failed");
+        return(-1);
+    }
+    if ( !S_ISBLK(sb.st_mode) || (loki_updatemounts() < 0) ) {
+        return loki_getmountpoint_mtab(device, mntpt, max_size);
+    }
+
+    /* Get the mount point, preferring a mount of the whole filesystem */
+    dir = NULL;
+    for ( i=0; i<num_mounts; ++i ) {
+        if ( mount_table[i].dev == sb.st_rdev ) {
+            dir = mount_table[i].dir;
+            if ( mount_table[i].root ) {
+                break;
+            }
+        }
+    }
+    mounted = 0;
+    memset(mntpt, 0, max_size);
+    if ( dir ) {
+        mounted = 1;
+        assert(strlen(dir) < max_size);
+        strncpy(mntpt, dir, max_size-1);
+        mntpt[max_size-1] = '\0';
+    }
+    return(mounted);
+}
+
 #ifdef __TEST_MAIN
 int main(int argc, char *argv[])
 {
@@ -122,6 +122,46 @@ typedef int (*loki_prompt_func) (const char *file);
    disabled */
 extern void  loki_cdpromptfunction (loki_prompt_func func);
 
+/* How long to wait for the file to show up, after the prompt function asks
+   to prompt again, before it is called again.  The default is 0, which
+   just looks for the file.  Nothing else runs while waiting, so a program
+   whose prompt doesn't wait for the CD itself should keep this short.
+ */
+extern void loki_cdpromptwait(int timeout_ms);
+
+/* Callback function called when a watched data file becomes available.
+   'path' is the absolute path where the file was found.
+ */
+typedef void (*loki_avail_func) (const char *file, const char *path, void *data);
+
+/* This function registers a callback to be called when a data file shows
+   up in the data or CD-ROM path, for example when the CD is inserted.
+   If the file is already available, the callback is called right away
+   and this returns 1, otherwise it returns 0, or -1 on error.
+   The callbacks are called from loki_pollwatches().
+ */
+extern int loki_watchdatafile(const char *file, loki_avail_func func, void *data);
+
+/* This function returns a descriptor which becomes readable when a watched
+   file may have become available, so it can be added to a select() loop.
+   If the directories can't all be watched, it becomes readable every
+   second instead, so that loki_pollwatches() can look for the files.
+ */
+extern int loki_getwatchfd(void);
+
+/* This function waits up to 'timeout_ms' milliseconds (-1 means forever,
+   0 means don't wait) for changes, and calls the callbacks for watched
+   files which have become available.  It returns the number of callbacks.
+ */
+extern int loki_pollwatches(int timeout_ms);
+
+/* This function waits up to 'timeout_ms' milliseconds (-1 means forever)
+   for a data file to become available, and returns whether it is.
+   The callbacks for other watched files aren't called while waiting,
+   they are left for the next loki_pollwatches().
+ */
+extern int loki_waitdatafile(const char *file, int timeout_ms);
+
 /* Returns the absolute path of a data file under datapath */
 extern char *loki_getdatafile(const char *file, char *filepath, int maxpath);
 /* The same, but its presence is necesary and the CDROM is prompted if needed */
@@ -131,6 +171,36 @@ extern char *loki_getpreffile(const char *file, char *filepath, int maxpath);
 /* And to get a file from the CDROM, if its path has been set */
 extern char *loki_getcdromfile(const char *file, char *filepath, int maxpath);
 
+/* These are the same as the functions above, but they return the length
+   of the resulting path, or -1 if it didn't fit in maxpath bytes, in which
+   case the path is truncated.  The directory lengths are cached, so these
+   are cheap enough to call for every asset load.
+ */
+extern int loki_builddatafile(const char *file, char *filepath, int maxpath);
+extern int loki_buildpreffile(const char *file, char *filepath, int maxpath);
+extern int loki_buildcdromfile(const char *file, char *filepath, int maxpath);
+
+/* This function builds "dir/file" into filepath, returning the length of
+   the result, or -1 if it didn't fit in maxpath bytes.
+ */
+extern int loki_buildpath(const char *dir, const char *file,
+                          char *filepath, int maxpath);
+
+/* A data file whose location is looked up once and remembered */
+typedef struct loki_datafile loki_datafile;
+
+/* This function returns the handle for a data file, which stays valid for
+   the life of the program.  Interning the same name again returns the same
+   handle.  The location is looked up again only when the data or CD-ROM
+   path changes, or while the file hasn't been found.  Returns NULL if out
+   of memory.
+ */
+extern loki_datafile *loki_interndatafile(const char *file);
+/* The absolute path of the data file, as loki_getdatafile() would return */
+extern const char *loki_datafilepath(loki_datafile *handle);
+/* Whether the data file can be read, once found it is assumed to stay */
+extern int loki_datafileexists(loki_datafile *handle);
+
 /* This function returns the home directory for the current user */
 extern char *loki_gethomedir(void);
 
@@ -139,12 +209,23 @@ void loki_splitpath(const char *path, char *drive, char *dir, char *fname, char
 
 /* File functions which look in the prefs path for write access,
    and the prefs path then the data path then the cdrom path for write access.
+   If the LOKI_FILETRACE environment variable is set, a summary of where
+   files were found is printed at exit, and if it names a file, every
+   lookup is logged there for use with the packorder tool.
 */
 extern int loki_stat(const char *file, struct stat *statb);
 extern FILE *loki_fopen(const char *file, const char *mode);
 extern int loki_open(const char *file, int flags, mode_t mode);
 extern FILE *loki_fopen_nocase(const char *file, const char *mode);
-    
+
+/* This function warms the page cache for a NULL terminated list of files,
+   looked up in the same order as loki_open(), in a background thread.
+   At most 'budget' bytes are read ahead in total (0 means no limit).
+   This is useful for data on slow CD-ROM or network mounted paths.
+   Returns 0 if the prefetch was started, or -1 if it couldn't be.
+*/
+extern int loki_prefetch(const char *files[], size_t budget);
+
 /* Returns the available disk space in kilobytes on the filesystem that contains "path" */
 extern size_t loki_getavailablespace(const char *path);
 
@@ -0,0 +1,429 @@
+/*
+    Loki Game Utility Functions
+    Copyright (C) 1999  Loki Software, Inc.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Notification of data files becoming available, for example when the
+   CD-ROM is inserted.  Rather than polling with access(), we wait for
+   inotify events in the directories the files would show up in, and for
+   changes to the mount table, and only look for the files when one of
+   those happens.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/timerfd.h>
+
+#include "loki_utils.h"
+
+#define WATCH_EVENTS    (IN_CREATE|IN_MOVED_TO|IN_CLOSE_WRITE|IN_ATTRIB| \
+                         IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)
+
+typedef struct file_watch {
+    char *file;
+    loki_avail_func func;
+    void *data;
+    struct file_watch *next;
+} file_watch;
+
+static file_watch *watches = NULL;
+
+static int epoll_fd = -1;
+static int inotify_fd = -1;
+static int mountinfo_fd = -1;
+static int timer_fd = -1;
+static int timer_polling = 0;
+static int recheck = 0;         /* Changes were taken without looking */
+static int *wds = NULL;
+static int num_wds = 0;
+static int max_wds = 0;
+static int missed_watch = 0;    /* Poll, since a directory isn't watched */
+
+/* See if a file can be found in the data or CD-ROM path yet */
+static int loki_fileavailable(const char *file, char *path, int maxpath)
+{
+    loki_getdatafile(file, path, maxpath);
+    return (access(path, R_OK) == 0);
+}
+
+static int loki_initwatches(void)
+{
+    struct epoll_event event;
+
+    if ( epoll_fd >= 0 ) {
+        return 0;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if ( epoll_fd < 0 ) {
+        return -1;
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if ( inotify_fd >= 0 ) {
+        event.events = EPOLLIN;
+        event.data.fd = inotify_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event);
+    }
+    /* The kernel flags the mount table with POLLPRI when it changes */
+    mountinfo_fd = open("/proc/self/mountinfo", O_RDONLY|O_CLOEXEC);
+    if ( mountinfo_fd >= 0 ) {
+        event.events = EPOLLPRI;
+        event.data.fd = mountinfo_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mountinfo_fd, &event);
+    }
+    /* This goes off while we have to poll, so the fd becomes readable */
+    timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC);
+    if ( timer_fd >= 0 ) {
+        event.events = EPOLLIN;
+        event.data.fd = timer_fd;
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+    }
+    return 0;
+}
+
+/* See if we have to look for the files every so often */
+static int loki_needpolling(void)
+{
+    return watches &&
+           (missed_watch || ((inotify_fd < 0) && (mountinfo_fd < 0)));
+}
+
+/* Start the timer going off every second if we have to poll, or stop it */
+static void loki_settimer(void)
+{
+    struct itimerspec spec;
+    int polling;
+
+    polling = loki_needpolling();
+    if ( (timer_fd < 0) || (polling == timer_polling) ) {
+        return;
+    }
+    memset(&spec, 0, sizeof(spec));
+    if ( polling ) {
+        spec.it_value.tv_sec = 1;
+        spec.it_interval.tv_sec = 1;
+    }
+    timerfd_settime(timer_fd, 0, &spec, NULL);
+    timer_polling = polling;
+}
+
+/* Watch the deepest existing directory 'file' would show up in under 'root'.
+   The watch is added to the ones from 'first' on in wds, if not there yet.
+ */
+static void loki_addwatch(const char *root, const char *file, int first)
+{
+    char path[PATH_MAX], *sep;
+    int wd, i, *tmp;
+
+    if ( snprintf(path, sizeof(path), "%s/%s", root, file) >= sizeof(path) ) {
+        missed_watch = 1;
+        return;
+    }
+    sep = path + strlen(root);
+    for ( ;; ) {
+        *strrchr(path, '/') = '\0';
+        wd = inotify_add_watch(inotify_fd, path, WATCH_EVENTS|IN_ONLYDIR);
+        if ( (wd >= 0) || (strrchr(path, '/') < sep) ) {
+            break;
+        }
+    }
+    if ( wd < 0 ) {
+        missed_watch = 1;
+        return;
+    }
+    for ( i=first; (i < num_wds) && (wds[i] != wd); ++i )
+        ;
+    if ( i < num_wds ) {
+        return;
+    }
+    if ( num_wds == max_wds ) {
+        tmp = (int *)realloc(wds, (max_wds ? max_wds*2 : 16) * sizeof(*wds));
+        if ( ! tmp ) {
+            missed_watch = 1;
+            return;
+        }
+        wds = tmp;
+        max_wds = max_wds ? max_wds*2 : 16;
+    }
+    wds[num_wds++] = wd;
+}
+
+/* Forget a watch the kernel has dropped, as when its directory went away */
+static void loki_dropwatch(int wd)
+{
+    int i;
+
+    for ( i=0; i<num_wds; ++i ) {
+        if ( wds[i] == wd ) {
+            wds[i] = wds[--num_wds];
+            break;
+        }
+    }
+}
+
+/* Set up the directory watches for the files we're waiting for.
+   This is redone after every change, since new directories may have
+   appeared, and a mount replaces the directory we were watching.
+   The new watches are put after the old ones in wds, and then the old
+   ones which aren't needed any more are removed.  Removing a watch wakes
+   us up once more, but the next time around the set doesn't change.
+ */
+static void loki_rearmwatches(void)
+{
+    file_watch *watch;
+    int old, i, j;
+
+    if ( inotify_fd >= 0 ) {
+        missed_watch = 0;
+        old = num_wds;
+        for ( watch = watches; watch; watch = watch->next ) {
+            if ( *loki_getdatapath() ) {
+                loki_addwatch(loki_getdatapath(), watch->file, old);
+            }
+            if ( loki_hascdrompath() ) {
+                loki_addwatch(loki_getcdrompath(), watch->file, old);
+            }
+        }
+        for ( i=0; i<old; ++i ) {
+            for ( j=old; (j < num_wds) && (wds[j] != wds[i]); ++j )
+                ;
+            if ( j == num_wds ) {
+                inotify_rm_watch(inotify_fd, wds[i]);
+            }
+        }
+        num_wds -= old;
+        memmove(wds, wds+old, num_wds * sizeof(*wds));
+    }
+    loki_settimer();
+}
+
+/* Register a callback for when a data file becomes available */
+int loki_watchdatafile(const char *file, loki_avail_func func, void *data)
+{
+    char path[PATH_MAX];
+    file_watch *watch;
+
+    if ( loki_fileavailable(file, path, sizeof(path)) ) {
+        (*func)(file, path, data);
+        return 1;
+    }
+    if ( loki_initwatches() < 0 ) {
+        return -1;
+    }
+    watch = (file_watch *)malloc(sizeof *watch);
+    if ( ! watch ) {
+        return -1;
+    }
+    watch->file = strdup(file);
+    if ( ! watch->file ) {
+        free(watch);
+        return -1;
+    }
+    watch->func = func;
+    watch->data = data;
+    watch->next = watches;
+    watches = watch;
+    loki_rearmwatches();
+
+    /* It may have shown up before the watches were in place */
+    if ( loki_fileavailable(file, path, sizeof(path)) ) {
+        watches = watch->next;
+        free(watch->file);
+        free(watch);
+        loki_rearmwatches();
+        (*func)(file, path, data);
+        return 1;
+    }
+    return 0;
+}
+
+int loki_getwatchfd(void)
+{
+    if ( loki_initwatches() < 0 ) {
+        return -1;
+    }
+    return epoll_fd;
+}
+
+/* Make the next loki_pollwatches() look for the files without waiting,
+   after changes were taken by loki_waitdatafile(), and make the watch fd
+   readable so that a select() loop calls it.
+ */
+static void loki_wakewatches(void)
+{
+    struct itimerspec spec;
+
+    recheck = 1;
+    if ( timer_fd >= 0 ) {
+        memset(&spec, 0, sizeof(spec));
+        spec.it_value.tv_nsec = 1;
+        if ( timer_polling ) {
+            spec.it_interval.tv_sec = 1;
+        }
+        timerfd_settime(timer_fd, 0, &spec, NULL);
+    }
+}
+
+/* Wait for changes, and set up the watches again after them.
+   Returns whether the files should be looked for.
+ */
+static int loki_waitchanges(int timeout_ms)
+{
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    struct epoll_event events[3];
+    struct inotify_event *event;
+    uint64_t expirations;
+    int i, n, len, pos, polling;
+
+    /* Fall back to polling every so often if we can't get notifications */
+    polling = loki_needpolling();
+    if ( polling && ((timeout_ms < 0) || (timeout_ms > 1000)) ) {
+        timeout_ms = 1000;
+    }
+    n = epoll_wait(epoll_fd, events, 3, timeout_ms);
+    if ( n <= 0 ) {
+        if ( ! polling ) {
+            return 0;
+        }
+        n = 0;
+    }
+
+    /* Drain the notifications, the mount table flag is cleared by polling */
+    for ( i=0; i<n; ++i ) {
+        if ( events[i].data.fd == inotify_fd ) {
+            while ( (len = read(inotify_fd, buf, sizeof(buf))) > 0 ) {
+                for ( pos = 0; pos < len;
+                      pos += sizeof(*event) + event->len ) {
+                    event = (struct inotify_event *)(buf + pos);
+                    if ( event->mask & IN_IGNORED ) {
+                        loki_dropwatch(event->wd);
+                    }
+                }
+            }
+        } else if ( events[i].data.fd == timer_fd ) {
+            read(timer_fd, &expirations, sizeof(expirations));
+        }
+    }
+
+    /* Arm the watches before looking, so nothing can slip in between */
+    loki_rearmwatches();
+    return 1;
+}
+
+/* Wait for changes and call the callbacks for files which have appeared */
+int loki_pollwatches(int timeout_ms)
+{
+    char path[PATH_MAX];
+    file_watch *watch, **prev;
+    int count;
+
+    if ( ! watches || (loki_initwatches() < 0) ) {
+        return 0;
+    }
+    if ( recheck ) {
+        timeout_ms = 0;
+    }
+    if ( ! loki_waitchanges(timeout_ms) && ! recheck ) {
+        return 0;
+    }
+    recheck = 0;
+
+    count = 0;
+    prev = &watches;
+    while ( (watch = *prev) != NULL ) {
+        if ( loki_fileavailable(watch->file, path, sizeof(path)) ) {
+            *prev = watch->next;
+            (*watch->func)(watch->file, path, watch->data);
+            free(watch->file);
+            free(watch);
+            ++count;
+        } else {
+            prev = &watch->next;
+        }
+    }
+    if ( ! watches ) {
+        loki_rearmwatches();
+    }
+    return count;
+}
+
+static void loki_setflag(const char *file, const char *path, void *data)
+{
+    *(int *)data = 1;
+}
+
+/* Wait for a data file to become available.  Only this file is looked
+   for, the callbacks for the others are left for loki_pollwatches().
+ */
+int loki_waitdatafile(const char *file, int timeout_ms)
+{
+    char path[PATH_MAX];
+    struct timeval start, now;
+    file_watch *watch, **prev;
+    int available, changed, elapsed;
+
+    if ( timeout_ms == 0 ) {
+        return loki_fileavailable(file, path, sizeof(path));
+    }
+    available = 0;
+    if ( loki_watchdatafile(file, loki_setflag, &available) != 0 ) {
+        return available;
+    }
+    gettimeofday(&start, NULL);
+    changed = 0;
+    elapsed = 0;
+    while ( ! available ) {
+        if ( timeout_ms >= 0 ) {
+            gettimeofday(&now, NULL);
+            elapsed = (now.tv_sec - start.tv_sec) * 1000 +
+                      (now.tv_usec - start.tv_usec) / 1000;
+            if ( elapsed >= timeout_ms ) {
+                break;
+            }
+        }
+        if ( loki_waitchanges((timeout_ms < 0) ? -1 :
+                              (timeout_ms - elapsed)) ) {
+            changed = 1;
+            available = loki_fileavailable(file, path, sizeof(path));
+        }
+    }
+
+    /* Our callback was never called, so take it out */
+    for ( prev = &watches; (watch = *prev) != NULL; prev = &watch->next ) {
+        if ( watch->data == &available ) {
+            *prev = watch->next;
+            free(watch->file);
+            free(watch);
+            break;
+        }
+    }
+    loki_rearmwatches();
+
+    /* The other files may have shown up with the changes we took */
+    if ( changed && watches ) {
+        loki_wakewatches();
+    }
+    return available;
+}
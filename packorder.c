@@ -0,0 +1,133 @@
+/* Turn a file access trace into a file order for a data pack.
+
+   Run the game with LOKI_FILETRACE=trace.txt, then:
+    packorder trace.txt > order.txt
+
+   Files are listed in the order they were first opened, so that files
+   used together end up next to each other on the disc.  Only files found
+   in the data and CD-ROM directories are listed, since the others aren't
+   part of the game data.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HASH_SIZE   4096
+
+typedef struct entry {
+    char *name;
+    long size;
+    int count;
+    struct entry *next;     /* In the hash chain */
+    struct entry *order;    /* In first access order */
+} entry;
+
+static entry *table[HASH_SIZE];
+static entry *first = NULL, *last = NULL;
+
+static unsigned int hash(const char *str)
+{
+    unsigned int h = 0;
+
+    while ( *str ) {
+        h = (h * 31) + (unsigned char)*str++;
+    }
+    return h % HASH_SIZE;
+}
+
+static void add_file(const char *name, long size)
+{
+    unsigned int h = hash(name);
+    entry *e;
+
+    for ( e=table[h]; e; e=e->next ) {
+        if ( strcmp(e->name, name) == 0 ) {
+            e->count++;
+            return;
+        }
+    }
+    e = (entry *)malloc(sizeof *e);
+    if ( ! e || ! (e->name = strdup(name)) ) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    e->size = size;
+    e->count = 1;
+    e->next = table[h];
+    table[h] = e;
+    e->order = NULL;
+    if ( last ) {
+        last->order = e;
+    } else {
+        first = e;
+    }
+    last = e;
+}
+
+int main(int argc, char **argv)
+{
+    char line[4096], *field[7], *ptr;
+    int i, verbose = 0;
+    long total = 0;
+    FILE *fp;
+    entry *e;
+
+    if ( (argc > 1) && (strcmp(argv[1], "-v") == 0) ) {
+        verbose = 1;
+        ++argv; --argc;
+    }
+    if ( argc < 2 ) {
+        fprintf(stderr, "Usage: %s [-v] trace.txt ...\n", argv[0]);
+        return 1;
+    }
+
+    for ( ; argv[1]; ++argv ) {
+        fp = fopen(argv[1], "r");
+        if ( ! fp ) {
+            perror(argv[1]);
+            return 1;
+        }
+        while ( fgets(line, sizeof(line), fp) ) {
+            ptr = strchr(line, '\n');
+            if ( ptr ) {
+                *ptr = '\0';
+            }
+            /* The name is the last field, and may contain tabs */
+            ptr = line;
+            for ( i=0; i<7; ++i ) {
+                field[i] = ptr;
+                if ( i < 6 ) {
+                    ptr = strchr(ptr, '\t');
+                    if ( ! ptr ) {
+                        break;
+                    }
+                    *ptr++ = '\0';
+                }
+            }
+            if ( i < 7 ) {
+                continue;
+            }
+            if ( (strcmp(field[1], "data") == 0) ||
+                 (strcmp(field[1], "cdrom") == 0) ) {
+                add_file(field[6], atol(field[5]));
+            }
+        }
+        fclose(fp);
+    }
+
+    for ( e=first; e; e=e->order ) {
+        if ( verbose ) {
+            printf("%10ld %5d  %s\n", e->size, e->count, e->name);
+        } else {
+            printf("%s\n", e->name);
+        }
+        if ( e->size > 0 ) {
+            total += e->size;
+        }
+    }
+    if ( verbose ) {
+        printf("%10ld bytes total\n", total);
+    }
+    return 0;
+}
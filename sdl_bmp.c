@@ -0,0 +1,215 @@
+/* $Id$ */
+/* A BMP decoder for the common uncompressed formats, which works on plain
+   memory so that images can be decoded on worker threads.  Anything else
+   is left to SDL_LoadBMP().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "SDL.h"
+#include "SDL_endian.h"
+
+#include "sdl_decode.h"
+
+#define BI_RGB		0
+#define BI_BITFIELDS	3
+
+#define BMP_LE16(p)	((Uint16)((p)[0] | ((p)[1] << 8)))
+#define BMP_LE32(p)	((Uint32)((p)[0] | ((p)[1] << 8) | \
+			          ((p)[2] << 16) | ((Uint32)(p)[3] << 24)))
+
+/* Work out the pixel format of the image from the headers */
+static int BMP_GetFormat(const Uint8 *data, size_t size, sdl_pixels *image,
+                         Uint32 *offset, int *topdown)
+{
+	Uint32 hsize, compression, ncolors;
+	const Uint8 *pal;
+	int height, palsize, i;
+
+	if ( (size < 26) || (data[0] != 'B') || (data[1] != 'M') ) {
+		return(1);
+	}
+	*offset = BMP_LE32(data + 10);
+	hsize = BMP_LE32(data + 14);
+	if ( hsize == 12 ) {
+		/* OS/2 1.x header */
+		image->w = BMP_LE16(data + 18);
+		height = (Sint16)BMP_LE16(data + 20);
+		image->bpp = BMP_LE16(data + 24);
+		compression = BI_RGB;
+		ncolors = 0;
+		palsize = 3;
+	} else if ( (hsize >= 40) && (size >= (14 + hsize)) ) {
+		image->w = (Sint32)BMP_LE32(data + 18);
+		height = (Sint32)BMP_LE32(data + 22);
+		image->bpp = BMP_LE16(data + 28);
+		compression = BMP_LE32(data + 30);
+		ncolors = BMP_LE32(data + 46);
+		palsize = 4;
+	} else {
+		return(1);
+	}
+	*topdown = (height < 0);
+	image->h = *topdown ? -height : height;
+	if ( (image->w <= 0) || (image->h <= 0) ||
+	     (image->w > 16384) || (image->h > 16384) ) {
+		return(-1);
+	}
+	image->pitch = SDL_PIXELS_PITCH(image->w, image->bpp);
+	image->Rmask = image->Gmask = image->Bmask = image->Amask = 0;
+	image->ncolors = 0;
+
+	switch (image->bpp) {
+	    case 8:
+		if ( compression != BI_RGB ) {
+			return(1);
+		}
+		if ( (ncolors == 0) || (ncolors > 256) ) {
+			ncolors = 256;
+		}
+		pal = data + 14 + hsize;
+		if ( (pal + ncolors*palsize) > (data + size) ) {
+			return(-1);
+		}
+		for ( i=0; i<ncolors; ++i ) {
+			image->colors[i].b = pal[0];
+			image->colors[i].g = pal[1];
+			image->colors[i].r = pal[2];
+			image->colors[i].unused = 0;
+			pal += palsize;
+		}
+		image->ncolors = ncolors;
+		break;
+
+	    case 16:
+	    case 32:
+		if ( compression == BI_BITFIELDS ) {
+			if ( size < (14 + 40 + 12) ) {
+				return(-1);
+			}
+			image->Rmask = BMP_LE32(data + 54);
+			image->Gmask = BMP_LE32(data + 58);
+			image->Bmask = BMP_LE32(data + 62);
+			if ( hsize >= 56 ) {
+				image->Amask = BMP_LE32(data + 66);
+			}
+		} else if ( compression == BI_RGB ) {
+			if ( image->bpp == 16 ) {
+				image->Rmask = 0x7C00;
+				image->Gmask = 0x03E0;
+				image->Bmask = 0x001F;
+			} else {
+				image->Rmask = 0x00FF0000;
+				image->Gmask = 0x0000FF00;
+				image->Bmask = 0x000000FF;
+			}
+		} else {
+			return(1);
+		}
+		break;
+
+	    case 24:
+		if ( compression != BI_RGB ) {
+			return(1);
+		}
+		/* The pixels are stored blue first */
+		if ( SDL_BYTEORDER == SDL_LIL_ENDIAN ) {
+			image->Rmask = 0x00FF0000;
+			image->Gmask = 0x0000FF00;
+			image->Bmask = 0x000000FF;
+		} else {
+			image->Rmask = 0x000000FF;
+			image->Gmask = 0x0000FF00;
+			image->Bmask = 0x00FF0000;
+		}
+		break;
+
+	    default:
+		/* Let SDL expand the 1 and 4 bit, and RLE compressed, images */
+		return(1);
+	}
+	return(0);
+}
+
+/* Decode a BMP file into memory, this is safe to call from any thread */
+int sdl_DecodeBMP_internal(const char *filename, sdl_pixels *image)
+{
+	struct stat sb;
+	const Uint8 *src;
+	Uint8 *data, *dst;
+	Uint32 offset;
+	int topdown, srcpitch, len;
+	int fd, y, status;
+
+	status = 1;
+	data = NULL;
+	fd = open(filename, O_RDONLY);
+	if ( fd >= 0 ) {
+		if ( (fstat(fd, &sb) == 0) && S_ISREG(sb.st_mode) &&
+		     (sb.st_size > 0) && (sb.st_size <= INT_MAX) ) {
+			data = (Uint8 *)mmap(NULL, sb.st_size, PROT_READ,
+			                     MAP_PRIVATE, fd, 0);
+		}
+		close(fd);
+	}
+	if ( ! data || (data == (Uint8 *)MAP_FAILED) ) {
+		return(status);
+	}
+
+	status = BMP_GetFormat(data, sb.st_size, image, &offset, &topdown);
+	if ( status != 0 ) {
+		goto done;
+	}
+	status = -1;
+	srcpitch = ((image->w * image->bpp + 31) / 32) * 4;
+	if ( (offset > sb.st_size) ||
+	     ((sb.st_size - offset) / srcpitch < image->h) ) {
+		goto done;
+	}
+	image->pixels = (Uint8 *)malloc(image->h * image->pitch);
+	if ( ! image->pixels ) {
+		goto done;
+	}
+
+	/* The rows are stored bottom up, unless the height is negative */
+	len = (srcpitch < image->pitch) ? srcpitch : image->pitch;
+	src = data + offset;
+	for ( y=0; y<image->h; ++y ) {
+		if ( topdown ) {
+			dst = image->pixels + y*image->pitch;
+		} else {
+			dst = image->pixels + (image->h-y-1)*image->pitch;
+		}
+		memcpy(dst, src, len);
+		src += srcpitch;
+	}
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	/* The 16 and 32-bit pixels are stored little endian */
+	for ( y=0; y<image->h; ++y ) {
+		dst = image->pixels + y*image->pitch;
+		if ( image->bpp == 16 ) {
+			Uint16 *pix = (Uint16 *)dst;
+			for ( len=0; len<image->w; ++len ) {
+				pix[len] = SDL_SwapLE16(pix[len]);
+			}
+		} else if ( image->bpp == 32 ) {
+			Uint32 *pix = (Uint32 *)dst;
+			for ( len=0; len<image->w; ++len ) {
+				pix[len] = SDL_SwapLE32(pix[len]);
+			}
+		}
+	}
+#endif
+	status = 0;
+
+done:
+	munmap(data, sb.st_size);
+	return(status);
+}
@@ -0,0 +1,459 @@
+/*
+    Loki Game Utility Functions
+    Copyright (C) 1999  Loki Software, Inc.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Frame capture.  Each frame is copied into one of a ring of buffers
+   allocated when the capture starts, and a background thread streams
+   them to a single file.  If the disk falls behind and the ring is full,
+   the frame is dropped instead of making the game wait.
+
+   The capture file is laid out as follows, all values little endian:
+
+     0  "LCAP"
+     4  version (1)
+     8  width, height, bits per pixel, bytes per row
+    24  red, green, blue and alpha masks
+    40  number of frames written
+    44  number of frames dropped
+    48  offset of the frame index (64-bit)
+    56  number of palette entries
+    60  byte order of the pixel data (1234 or 4321)
+    64  the palette, 4 bytes per entry (red, green, blue, 0)
+
+   followed by the raw frames, with the rows packed together, and then
+   the index, which has an entry for each frame written:
+
+     0  frame number, counting dropped frames, so drops show up as gaps
+     4  milliseconds since the capture started
+     8  offset of the frame in the file (64-bit)
+*/
+
+#define _FILE_OFFSET_BITS 64
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "SDL.h"
+#include "SDL_thread.h"
+#include "loki_utils.h"
+#include "sdl_utils.h"
+
+#define CAPTURE_VERSION         1
+#define CAPTURE_HEADER_SIZE     64
+#define CAPTURE_INDEX_SIZE      16
+
+/* The default number of frames that can wait for the disk */
+#define DEFAULT_CAPTURE_BUFFERS 8
+
+typedef struct {
+    Uint32 frame;
+    Uint32 ticks;
+} capture_slot;
+
+typedef struct {
+    Uint32 frame;
+    Uint32 ticks;
+    off_t offset;
+} capture_entry;
+
+static struct {
+    FILE *fp;
+    int w, h, bpp, rowlen;
+    size_t framelen;
+    Uint32 Rmask, Gmask, Bmask, Amask;
+    int ncolors;
+    SDL_Color colors[256];
+
+    /* The ring of frame buffers, shared with the writer thread */
+    Uint8 *buffers;
+    capture_slot *slots;
+    int nbuffers;
+    int head, tail, count;
+    int quit;
+    SDL_mutex *lock;
+    SDL_cond *cond;
+    SDL_Thread *thread;
+
+    /* Only used by the writer thread until it has finished */
+    capture_entry *index;
+    int written, maxindex;
+    int failed;
+
+    Uint32 start;
+    Uint32 frame;
+    int dropped;
+} capture;
+
+static int capturing = 0;
+static int capture_atexit = 0;
+
+static void sdl_CapturePutLE32(Uint8 *p, Uint32 value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+static void sdl_CapturePutLE64(Uint8 *p, off_t value)
+{
+    sdl_CapturePutLE32(p, (Uint32)value);
+    sdl_CapturePutLE32(p + 4, (Uint32)((Uint64)value >> 32));
+}
+
+static int sdl_WriteCaptureHeader(off_t index_offset)
+{
+    Uint8 header[CAPTURE_HEADER_SIZE], entry[4];
+    int i;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, "LCAP", 4);
+    sdl_CapturePutLE32(header + 4, CAPTURE_VERSION);
+    sdl_CapturePutLE32(header + 8, capture.w);
+    sdl_CapturePutLE32(header + 12, capture.h);
+    sdl_CapturePutLE32(header + 16, capture.bpp);
+    sdl_CapturePutLE32(header + 20, capture.rowlen);
+    sdl_CapturePutLE32(header + 24, capture.Rmask);
+    sdl_CapturePutLE32(header + 28, capture.Gmask);
+    sdl_CapturePutLE32(header + 32, capture.Bmask);
+    sdl_CapturePutLE32(header + 36, capture.Amask);
+    sdl_CapturePutLE32(header + 40, capture.written);
+    sdl_CapturePutLE32(header + 44, capture.dropped);
+    sdl_CapturePutLE64(header + 48, index_offset);
+    sdl_CapturePutLE32(header + 56, capture.ncolors);
+    sdl_CapturePutLE32(header + 60, SDL_BYTEORDER);
+    if ( (fseeko(capture.fp, 0, SEEK_SET) < 0) ||
+         (fwrite(header, sizeof(header), 1, capture.fp) != 1) ) {
+        return(-1);
+    }
+    for ( i=0; i<capture.ncolors; ++i ) {
+        entry[0] = capture.colors[i].r;
+        entry[1] = capture.colors[i].g;
+        entry[2] = capture.colors[i].b;
+        entry[3] = 0;
+        if ( fwrite(entry, sizeof(entry), 1, capture.fp) != 1 ) {
+            return(-1);
+        }
+    }
+    return(0);
+}
+
+/* Append a frame to the file and remember where it went */
+static int sdl_WriteCaptureFrame(const Uint8 *pixels, const capture_slot *slot)
+{
+    capture_entry *index;
+    off_t offset;
+
+    if ( capture.written == capture.maxindex ) {
+        capture.maxindex = capture.maxindex ? capture.maxindex * 2 : 1024;
+        index = (capture_entry *)realloc(capture.index,
+                               capture.maxindex * sizeof(*index));
+        if ( ! index ) {
+            return(-1);
+        }
+        capture.index = index;
+    }
+    offset = ftello(capture.fp);
+    if ( (offset < 0) ||
+         (fwrite(pixels, capture.framelen, 1, capture.fp) != 1) ) {
+        return(-1);
+    }
+    index = &capture.index[capture.written++];
+    index->frame = slot->frame;
+    index->ticks = slot->ticks;
+    index->offset = offset;
+    return(0);
+}
+
+static int sdl_CaptureWriter(void *unused)
+{
+    int slot, status;
+
+    SDL_mutexP(capture.lock);
+    for ( ;; ) {
+        while ( ! capture.count && ! capture.quit ) {
+            SDL_CondWait(capture.cond, capture.lock);
+        }
+        if ( ! capture.count ) {
+            break;
+        }
+        slot = capture.tail;
+        SDL_mutexV(capture.lock);
+
+        /* Once a write fails, the rest of the frames are thrown away */
+        status = -1;
+        if ( ! capture.failed ) {
+            status = sdl_WriteCaptureFrame(
+                capture.buffers + slot * capture.framelen,
+                &capture.slots[slot]);
+            if ( status < 0 ) {
+                capture.failed = 1;
+            }
+        }
+
+        SDL_mutexP(capture.lock);
+        if ( status < 0 ) {
+            ++capture.dropped;
+        }
+        capture.tail = (capture.tail + 1) % capture.nbuffers;
+        --capture.count;
+    }
+    SDL_mutexV(capture.lock);
+    return(0);
+}
+
+static void sdl_FreeCapture(void)
+{
+    if ( capture.fp ) {
+        fclose(capture.fp);
+    }
+    if ( capture.lock ) {
+        SDL_DestroyMutex(capture.lock);
+    }
+    if ( capture.cond ) {
+        SDL_DestroyCond(capture.cond);
+    }
+    free(capture.buffers);
+    free(capture.slots);
+    free(capture.index);
+    memset(&capture, 0, sizeof(capture));
+    capturing = 0;
+}
+
+/* Finish the capture file if the game quits while recording */
+static void sdl_StopCaptureAtExit(void)
+{
+    sdl_StopCapture();
+}
+
+int sdl_StartCapture(const char *filename, SDL_Surface *screen, int buffers)
+{
+    char path[PATH_MAX], name[128];
+    SDL_PixelFormat *format;
+    int i;
+
+    if ( capturing ) {
+        SDL_SetError("A capture is already running");
+        return(-1);
+    }
+    if ( ! screen ) {
+        screen = SDL_GetVideoSurface();
+        if ( ! screen ) {
+            SDL_SetError("There is no video surface to capture");
+            return(-1);
+        }
+    }
+    if ( buffers <= 0 ) {
+        buffers = DEFAULT_CAPTURE_BUFFERS;
+    }
+    if ( ! filename ) {
+        snprintf(name, sizeof(name), "%s_capture.lcap", loki_getgamename());
+        loki_getpreffile(name, path, sizeof(path));
+        filename = path;
+    }
+
+    memset(&capture, 0, sizeof(capture));
+    capturing = 1;
+    format = screen->format;
+    capture.w = screen->w;
+    capture.h = screen->h;
+    capture.bpp = format->BitsPerPixel;
+    capture.rowlen = screen->w * format->BytesPerPixel;
+    capture.framelen = (size_t)capture.rowlen * capture.h;
+    capture.Rmask = format->Rmask;
+    capture.Gmask = format->Gmask;
+    capture.Bmask = format->Bmask;
+    capture.Amask = format->Amask;
+    if ( format->palette ) {
+        capture.ncolors = format->palette->ncolors;
+        if ( capture.ncolors > 256 ) {
+            capture.ncolors = 256;
+        }
+        for ( i=0; i<capture.ncolors; ++i ) {
+            capture.colors[i] = format->palette->colors[i];
+        }
+    }
+
+    /* All the memory is allocated up front, so capturing never does */
+    if ( capture.framelen &&
+         ((size_t)buffers > SIZE_MAX / capture.framelen) ) {
+        SDL_SetError("Too many capture buffers for the screen size");
+        sdl_FreeCapture();
+        return(-1);
+    }
+    capture.nbuffers = buffers;
+    capture.buffers = (Uint8 *)malloc(buffers * capture.framelen);
+    capture.slots = (capture_slot *)malloc(buffers * sizeof(capture_slot));
+    if ( ! capture.buffers || ! capture.slots ) {
+        SDL_SetError("Out of memory");
+        sdl_FreeCapture();
+        return(-1);
+    }
+    capture.fp = fopen(filename, "wb");
+    if ( ! capture.fp ) {
+        SDL_SetError("Couldn't create %s", filename);
+        sdl_FreeCapture();
+        return(-1);
+    }
+    /* The header is written again with the totals when we're done */
+    if ( sdl_WriteCaptureHeader(0) < 0 ) {
+        SDL_SetError("Couldn't write to %s", filename);
+        sdl_FreeCapture();
+        return(-1);
+    }
+    capture.lock = SDL_CreateMutex();
+    capture.cond = SDL_CreateCond();
+    if ( capture.lock && capture.cond ) {
+        capture.thread = SDL_CreateThread(sdl_CaptureWriter, NULL);
+    }
+    if ( ! capture.thread ) {
+        sdl_FreeCapture();
+        return(-1);
+    }
+    if ( ! capture_atexit ) {
+        atexit(sdl_StopCaptureAtExit);
+        capture_atexit = 1;
+    }
+    capture.start = SDL_GetTicks();
+    return(0);
+}
+
+void sdl_CaptureFrame(SDL_Surface *screen)
+{
+    SDL_PixelFormat *format;
+    Uint8 *dst, *src;
+    int slot, y;
+
+    if ( ! capturing ) {
+        return;
+    }
+    if ( ! screen ) {
+        screen = SDL_GetVideoSurface();
+    }
+    ++capture.frame;
+
+    /* Drop the frame if the disk hasn't caught up yet */
+    SDL_mutexP(capture.lock);
+    if ( capture.count == capture.nbuffers ) {
+        ++capture.dropped;
+        SDL_mutexV(capture.lock);
+        return;
+    }
+    slot = capture.head;
+    SDL_mutexV(capture.lock);
+
+    /* A video mode change can't be recorded in the same file */
+    format = screen ? screen->format : NULL;
+    if ( ! format || (screen->w != capture.w) || (screen->h != capture.h) ||
+         (format->BitsPerPixel != capture.bpp) ||
+         (! screen->pixels && ! SDL_MUSTLOCK(screen)) ||
+         (SDL_MUSTLOCK(screen) && (SDL_LockSurface(screen) < 0)) ) {
+        SDL_mutexP(capture.lock);
+        ++capture.dropped;
+        SDL_mutexV(capture.lock);
+        return;
+    }
+
+    /* The writer thread doesn't touch the slot until it's queued */
+    dst = capture.buffers + slot * capture.framelen;
+    src = (Uint8 *)screen->pixels;
+    for ( y=0; y<capture.h; ++y ) {
+        memcpy(dst, src, capture.rowlen);
+        dst += capture.rowlen;
+        src += screen->pitch;
+    }
+    if ( SDL_MUSTLOCK(screen) ) {
+        SDL_UnlockSurface(screen);
+    }
+    capture.slots[slot].frame = capture.frame - 1;
+    capture.slots[slot].ticks = SDL_GetTicks() - capture.start;
+
+    SDL_mutexP(capture.lock);
+    capture.head = (capture.head + 1) % capture.nbuffers;
+    ++capture.count;
+    SDL_CondSignal(capture.cond);
+    SDL_mutexV(capture.lock);
+}
+
+int sdl_CaptureDropped(void)
+{
+    int dropped;
+
+    dropped = 0;
+    if ( capturing ) {
+        SDL_mutexP(capture.lock);
+        dropped = capture.dropped;
+        SDL_mutexV(capture.lock);
+    }
+    return(dropped);
+}
+
+int sdl_StopCapture(void)
+{
+    Uint8 entry[CAPTURE_INDEX_SIZE];
+    off_t index_offset;
+    int i, status;
+
+    if ( ! capturing ) {
+        return(0);
+    }
+
+    /* Let the writer drain the ring before it goes away */
+    SDL_mutexP(capture.lock);
+    capture.quit = 1;
+    SDL_CondSignal(capture.cond);
+    SDL_mutexV(capture.lock);
+    SDL_WaitThread(capture.thread, NULL);
+
+    status = capture.failed ? -1 : 0;
+    index_offset = ftello(capture.fp);
+    if ( index_offset < 0 ) {
+        status = -1;
+    }
+    for ( i=0; (i < capture.written) && (status == 0); ++i ) {
+        sdl_CapturePutLE32(entry, capture.index[i].frame);
+        sdl_CapturePutLE32(entry + 4, capture.index[i].ticks);
+        sdl_CapturePutLE64(entry + 8, capture.index[i].offset);
+        if ( fwrite(entry, sizeof(entry), 1, capture.fp) != 1 ) {
+            status = -1;
+        }
+    }
+    if ( (status == 0) && (sdl_WriteCaptureHeader(index_offset) < 0) ) {
+        status = -1;
+    }
+    if ( fclose(capture.fp) != 0 ) {
+        status = -1;
+    }
+    capture.fp = NULL;
+
+    if ( status < 0 ) {
+        SDL_SetError("Couldn't write the capture file");
+    } else {
+        status = capture.dropped;
+        if ( status > 0 ) {
+            fprintf(stderr, "Capture: %d frames written, %d dropped\n",
+                    capture.written, capture.dropped);
+        }
+    }
+    sdl_FreeCapture();
+    return(status);
+}
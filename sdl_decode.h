@@ -0,0 +1,40 @@
+#ifndef __SDLDECODE_H__
+#define __SDLDECODE_H__
+
+/* Image decoding into plain memory buffers, without any SDL calls, so
+   that it can be done on worker threads.  The buffer is laid out exactly
+   as a software surface with the same format would be, so it can be
+   copied straight into one.
+*/
+
+#include "SDL.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int w, h;
+    int bpp;
+    int pitch;
+    Uint32 Rmask, Gmask, Bmask, Amask;
+    int ncolors;
+    SDL_Color colors[256];
+    Uint8 *pixels;
+} sdl_pixels;
+
+/* The pitch SDL uses for software surfaces */
+#define SDL_PIXELS_PITCH(w, bpp)    ((((w) * (bpp) + 7) / 8 + 3) & ~3)
+
+/* These return 0 if the image was decoded, -1 if it couldn't be read,
+   or 1 if the file isn't in a format the decoder understands.
+   The pixels should be released with free().
+ */
+extern int sdl_DecodePCX_internal(const char *filename, sdl_pixels *image);
+extern int sdl_DecodeBMP_internal(const char *filename, sdl_pixels *image);
+
+#ifdef __cplusplus
+};
+#endif
+
+#endif /* __SDLDECODE_H__ */
@@ -2,10 +2,30 @@
 /* This is a PCX image file loading framework, ripped straight from the SDL examples */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include "SDL.h"
 #include "SDL_endian.h"
 
 #include "sdl_utils.h"
+#include "sdl_decode.h"
+#include "loki_cpuinfo.h"
+
+/* Use SSSE3 byte shuffles to interleave 24-bit images, when the CPU has it */
+#if (defined(__i386__) || defined(__x86_64__)) && \
+    (defined(__clang__) || (__GNUC__ > 4) || \
+     ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define PCX_SSSE3
+#include <tmmintrin.h>
+#endif
+
+/* The amount to read at a time when the size of the data isn't known */
+#define PCX_CHUNK	65536
 
 struct PCXheader {
 	Uint8 Manufacturer;
@@ -24,28 +44,533 @@ struct PCXheader {
 	Uint8 Filler[54];
 };
 
-/* See if an image is contained in a data source */
-static int IMG_isPCX(SDL_RWops *src)
+/* The state of the run-length decoder.  Runs may continue from the end
+   of one scanline onto the next, so the count is kept between lines.
+ */
+typedef struct {
+	const Uint8 *src;
+	const Uint8 *end;
+	int count;
+	Uint8 ch;
+} PCX_RLE;
+
+/* See if a header is that of a PCX image we can load */
+static int PCX_CheckHeader(const struct PCXheader *pcxh)
 {
-	int is_PCX;
 	const int ZSoft_Manufacturer = 10;
 	const int PC_Paintbrush_Version = 5;
 	const int PCX_RunLength_Encoding = 1;
+
+	return( (pcxh->Manufacturer == ZSoft_Manufacturer) &&
+	        (pcxh->Version == PC_Paintbrush_Version) &&
+	        (pcxh->Encoding == PCX_RunLength_Encoding) );
+}
+
+/* See if an image is contained in a data source */
+static int IMG_isPCX(SDL_RWops *src)
+{
+	int is_PCX;
 	struct PCXheader pcxh;
 
 	is_PCX = 0;
 	if ( SDL_RWread(src, &pcxh, sizeof(pcxh), 1) == 1 ) {
-		if ( (pcxh.Manufacturer == ZSoft_Manufacturer) &&
-		     (pcxh.Version == PC_Paintbrush_Version) &&
-		     (pcxh.Encoding == PCX_RunLength_Encoding) ) {
-			is_PCX = 1;
-		}
+		is_PCX = PCX_CheckHeader(&pcxh);
 	}
 	return(is_PCX);
 }
 
+/* Read the rest of the data source into memory in one go */
+static Uint8 *PCX_ReadBody(SDL_RWops *src, int *size)
+{
+	Uint8 *body, *newbody;
+	int start, end, len, amount;
+
+	body = NULL;
+	len = 0;
+	start = SDL_RWtell(src);
+	end = SDL_RWseek(src, 0, SEEK_END);
+	if ( (start >= 0) && (end >= start) &&
+	     (SDL_RWseek(src, start, SEEK_SET) == start) ) {
+		/* Add one so an empty body isn't mistaken for no memory */
+		body = (Uint8 *)malloc(end - start + 1);
+		if ( body ) {
+			len = SDL_RWread(src, body, 1, end - start);
+			if ( len < 0 ) {
+				len = 0;
+			}
+		}
+	} else {
+		/* Not seekable, read it a chunk at a time */
+		do {
+			newbody = (Uint8 *)realloc(body, len + PCX_CHUNK);
+			if ( ! newbody ) {
+				free(body);
+				return(NULL);
+			}
+			body = newbody;
+			amount = SDL_RWread(src, body + len, 1, PCX_CHUNK);
+			if ( amount > 0 ) {
+				len += amount;
+			}
+		} while ( amount == PCX_CHUNK );
+	}
+	*size = len;
+	return(body);
+}
+
+/* Decode 'len' bytes of run-length encoded data into 'dst' */
+static int PCX_DecodeLine(PCX_RLE *rle, Uint8 *dst, int len)
+{
+	const Uint8 *src;
+	int x, n;
+
+	x = 0;
+	while ( x < len ) {
+		if ( rle->count == 0 ) {
+			/* Copy literal bytes straight through */
+			src = rle->src;
+			while ( (x < len) && (src < rle->end) &&
+			        ((*src & 0xC0) != 0xC0) ) {
+				dst[x++] = *src++;
+			}
+			rle->src = src;
+			if ( x == len ) {
+				break;
+			}
+			if ( (rle->end - src) < 2 ) {
+				return(-1);
+			}
+			rle->count = src[0] & 0x3F;
+			rle->ch = src[1];
+			rle->src = src + 2;
+		}
+		n = len - x;
+		if ( n > rle->count ) {
+			n = rle->count;
+		}
+		memset(dst + x, rle->ch, n);
+		x += n;
+		rle->count -= n;
+	}
+	return(0);
+}
+
+/* Interleave the red, green and blue planes of a scanline into pixels */
+static void PCX_Interleave3_C(Uint8 *dst, const Uint8 *line, int bpl, int n)
+{
+	const Uint8 *r, *g, *b;
+	int x;
+
+	r = line;
+	g = r + bpl;
+	b = g + bpl;
+	for ( x=0; x<n; ++x ) {
+		*dst++ = r[x];
+		*dst++ = g[x];
+		*dst++ = b[x];
+	}
+}
+
+#ifdef PCX_SSSE3
+__attribute__((target("ssse3")))
+static void PCX_Interleave3_SSSE3(Uint8 *dst, const Uint8 *line, int bpl, int n)
+{
+	const Uint8 *r, *g, *b;
+	__m128i R, G, B, out;
+	int x;
+
+	r = line;
+	g = r + bpl;
+	b = g + bpl;
+	for ( x=0; x+16<=n; x+=16 ) {
+		R = _mm_loadu_si128((const __m128i *)(r + x));
+		G = _mm_loadu_si128((const __m128i *)(g + x));
+		B = _mm_loadu_si128((const __m128i *)(b + x));
+
+		/* Each 16 byte block of output takes bytes from all three planes,
+		   the shuffle indices with the top bit set produce zero bytes.
+		 */
+		out = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(R, _mm_setr_epi8(
+			0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1,5)),
+			_mm_shuffle_epi8(G, _mm_setr_epi8(
+			-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1))),
+			_mm_shuffle_epi8(B, _mm_setr_epi8(
+			-1,-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1)));
+		_mm_storeu_si128((__m128i *)dst, out);
+
+		out = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(R, _mm_setr_epi8(
+			-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10,-1)),
+			_mm_shuffle_epi8(G, _mm_setr_epi8(
+			5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10))),
+			_mm_shuffle_epi8(B, _mm_setr_epi8(
+			-1,5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1)));
+		_mm_storeu_si128((__m128i *)(dst + 16), out);
+
+		out = _mm_or_si128(_mm_or_si128(
+			_mm_shuffle_epi8(R, _mm_setr_epi8(
+			-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1,-1)),
+			_mm_shuffle_epi8(G, _mm_setr_epi8(
+			-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1))),
+			_mm_shuffle_epi8(B, _mm_setr_epi8(
+			10,-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15)));
+		_mm_storeu_si128((__m128i *)(dst + 32), out);
+
+		dst += 48;
+	}
+	PCX_Interleave3_C(dst, line + x, bpl, n - x);
+}
+#endif /* PCX_SSSE3 */
+
+/* Decode the image data into the surface pixels */
+static int PCX_Decode(const struct PCXheader *pcxh, PCX_RLE *rle,
+                      Uint8 *pixels, int pitch, int height)
+{
+	void (*interleave3)(Uint8 *dst, const Uint8 *line, int bpl, int n);
+	int bpl, nplanes, linelen;
+	int i, x, y, n;
+	Uint8 *row, *line;
+	int status;
+
+	bpl = pcxh->BytesPerLine;
+	nplanes = pcxh->NPlanes;
+	if ( (bpl <= 0) || (nplanes <= 0) ) {
+		return(-1);
+	}
+	linelen = bpl * nplanes;
+
+	/* Single plane images which fit are decoded straight to the surface */
+	line = NULL;
+	if ( (nplanes > 1) || (bpl > pitch) ) {
+		line = (Uint8 *)malloc(linelen);
+		if ( ! line ) {
+			return(-1);
+		}
+	}
+
+	/* The number of bytes of each plane that fit in a row of pixels */
+	n = pitch / nplanes;
+	if ( n > bpl ) {
+		n = bpl;
+	}
+
+	interleave3 = PCX_Interleave3_C;
+#ifdef PCX_SSSE3
+	if ( (nplanes == 3) && (loki_getcpuflags() & CPU_HAS_SSSE3) ) {
+		interleave3 = PCX_Interleave3_SSSE3;
+	}
+#endif
+
+	status = 0;
+	for ( y=0; y<height; ++y ) {
+		row = pixels + y*pitch;
+		if ( ! line ) {
+			if ( PCX_DecodeLine(rle, row, bpl) < 0 ) {
+				status = -1;
+				break;
+			}
+			continue;
+		}
+		if ( PCX_DecodeLine(rle, line, linelen) < 0 ) {
+			status = -1;
+			break;
+		}
+		if ( nplanes == 1 ) {
+			memcpy(row, line, pitch);
+		} else if ( nplanes == 3 ) {
+			interleave3(row, line, bpl, n);
+		} else {
+			for ( i=0; i<nplanes; ++i ) {
+				for ( x=0; x<n; ++x ) {
+					row[x*nplanes+i] = line[i*bpl+x];
+				}
+			}
+		}
+	}
+	free(line);
+	return(status);
+}
+
+/* Convert a header read from the file to the native byte order */
+static void PCX_SwapHeader(struct PCXheader *pcxh)
+{
+	pcxh->Xmin = SDL_SwapLE16(pcxh->Xmin);
+	pcxh->Ymin = SDL_SwapLE16(pcxh->Ymin);
+	pcxh->Xmax = SDL_SwapLE16(pcxh->Xmax);
+	pcxh->Ymax = SDL_SwapLE16(pcxh->Ymax);
+	pcxh->BytesPerLine = SDL_SwapLE16(pcxh->BytesPerLine);
+}
+
+/* Work out the pixel format of the image */
+static void PCX_GetFormat(const struct PCXheader *pcxh, sdl_pixels *format)
+{
+	format->w = (pcxh->Xmax - pcxh->Xmin) + 1;
+	format->h = (pcxh->Ymax - pcxh->Ymin) + 1;
+	format->bpp = pcxh->BitsPerPixel*pcxh->NPlanes;
+	format->pitch = SDL_PIXELS_PITCH(format->w, format->bpp);
+	format->Rmask = format->Gmask = format->Bmask = format->Amask = 0 ;
+	if ( pcxh->BitsPerPixel > 16 ) {
+		if ( SDL_BYTEORDER == SDL_LIL_ENDIAN ) {
+			format->Rmask = 0x000000FF;
+			format->Gmask = 0x0000FF00;
+			format->Bmask = 0x00FF0000;
+			format->Amask = 0xFF000000;
+		} else {
+			format->Rmask = 0xFF000000;
+			format->Gmask = 0x00FF0000;
+			format->Bmask = 0x0000FF00;
+			format->Amask = 0x000000FF;
+		}
+	}
+	format->ncolors = (format->bpp <= 8) ? (1 << format->bpp) : 0;
+}
+
+/* Decode the image data following the header in memory, and the palette */
+static int PCX_DecodeImage(const struct PCXheader *pcxh,
+                           const Uint8 *body, int size,
+                           Uint8 *pixels, int pitch, int height,
+                           SDL_Color *colors)
+{
+	int i;
+	const Uint8 *pal;
+	PCX_RLE rle;
+
+	/* Decode the image to the pixels */
+	rle.src = body;
+	rle.end = body + size;
+	rle.count = 0;
+	rle.ch = 0;
+	if ( PCX_Decode(pcxh, &rle, pixels, pitch, height) < 0 ) {
+		return(-1);
+	}
+
+	/* Look for the palette, if necessary */
+	switch (pcxh->BitsPerPixel*pcxh->NPlanes) {
+	    case 1: {
+		colors[0].r = 0x00;
+		colors[0].g = 0x00;
+		colors[0].b = 0x00;
+		colors[1].r = 0xFF;
+		colors[1].g = 0xFF;
+		colors[1].b = 0xFF;
+	    }
+	    break;
+
+	    case 8: {
+		/* The palette is the last 768 bytes of the file, after a marker.
+		   Some writers pad the image data, so if the marker isn't there
+		   look for it after the image.
+		 */
+		if ( (size >= 769) && (body[size-769] == 12) ) {
+			pal = body + size - 768;
+		} else {
+			pal = (const Uint8 *)memchr(rle.src, 12, rle.end - rle.src);
+			if ( ! pal ) {
+				return(-1);
+			}
+			++pal;
+		}
+
+		/* Set the image surface palette */
+		for ( i=0; (i<256) && ((rle.end - pal) >= 3); ++i ) {
+			colors[i].r = *pal++;
+			colors[i].g = *pal++;
+			colors[i].b = *pal++;
+		}
+	    }
+	    break;
+
+	    default: {
+		/* Don't do anything... */;
+	    }
+	    break;
+	}
+	return(0);
+}
+
+/* Create a surface from the image data following the header in memory */
+static SDL_Surface *PCX_Load(const struct PCXheader *pcxh,
+                             const Uint8 *body, int size)
+{
+	SDL_Surface *surface;
+	SDL_Color *colors;
+	sdl_pixels format;
+
+	/* Create the surface of the appropriate type */
+	PCX_GetFormat(pcxh, &format);
+	surface = SDL_CreateRGBSurface(SDL_SWSURFACE, format.w, format.h,
+			format.bpp, format.Rmask, format.Gmask, format.Bmask,
+			format.Amask);
+	if ( surface == NULL ) {
+		SDL_SetError("Out of memory");
+		return(NULL);
+	}
+	colors = NULL;
+	if ( surface->format->palette ) {
+		colors = surface->format->palette->colors;
+	}
+
+	if ( PCX_DecodeImage(pcxh, body, size, (Uint8 *)surface->pixels,
+	                     surface->pitch, surface->h, colors) < 0 ) {
+		SDL_FreeSurface(surface);
+		SDL_SetError("Error reading PCX data");
+		return(NULL);
+	}
+	return(surface);
+}
+
 /* Load a PCX type image from an SDL datasource */
 static SDL_Surface *IMG_LoadPCX_RW(SDL_RWops *src)
+{
+	struct PCXheader pcxh;
+	SDL_Surface *surface;
+	Uint8 *body;
+	int size;
+
+	/* Check to make sure we have something to do */
+	if ( ! src ) {
+		return(NULL);
+	}
+
+	/* Read and convert the header */
+	if ( ! SDL_RWread(src, &pcxh, sizeof(pcxh), 1) ) {
+		return(NULL);
+	}
+	PCX_SwapHeader(&pcxh);
+
+	/* Read the compressed data in one go, rather than a byte at a time */
+	body = PCX_ReadBody(src, &size);
+	if ( ! body ) {
+		SDL_SetError("Out of memory");
+		return(NULL);
+	}
+	surface = PCX_Load(&pcxh, body, size);
+	free(body);
+	return(surface);
+}
+
+/* Map a PCX file into memory and check the header, which is copied out
+   and converted, since it's unaligned and little endian.
+ */
+static Uint8 *PCX_MapFile(const char *filename, size_t *size,
+                          struct PCXheader *pcxh)
+{
+	struct stat sb;
+	Uint8 *data;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if ( fd < 0 ) {
+		return(NULL);
+	}
+	if ( (fstat(fd, &sb) < 0) || ! S_ISREG(sb.st_mode) ||
+	     (sb.st_size < (off_t)sizeof(*pcxh)) || (sb.st_size > INT_MAX) ) {
+		close(fd);
+		return(NULL);
+	}
+	data = (Uint8 *)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if ( data == (Uint8 *)MAP_FAILED ) {
+		return(NULL);
+	}
+	madvise(data, sb.st_size, MADV_SEQUENTIAL);
+	*size = sb.st_size;
+
+	memcpy(pcxh, data, sizeof(*pcxh));
+	PCX_SwapHeader(pcxh);
+	return(data);
+}
+
+/* Load a PCX file by mapping it and decoding straight from the mapping */
+static SDL_Surface *PCX_LoadMapped(const char *filename, int *mapped)
+{
+	struct PCXheader pcxh;
+	SDL_Surface *surface;
+	Uint8 *data;
+	size_t size;
+
+	*mapped = 0;
+	data = PCX_MapFile(filename, &size, &pcxh);
+	if ( ! data ) {
+		return(NULL);
+	}
+	*mapped = 1;
+
+	surface = NULL;
+	if ( PCX_CheckHeader(&pcxh) ) {
+		surface = PCX_Load(&pcxh, data + sizeof(pcxh),
+		                   (int)(size - sizeof(pcxh)));
+	}
+	munmap(data, size);
+	return(surface);
+}
+
+/* Decode a PCX file into memory, this is safe to call from any thread */
+int sdl_DecodePCX_internal(const char *filename, sdl_pixels *image)
+{
+	struct PCXheader pcxh;
+	Uint8 *data;
+	size_t size;
+	int status;
+
+	data = PCX_MapFile(filename, &size, &pcxh);
+	if ( ! data ) {
+		return(1);
+	}
+	status = 1;
+	if ( PCX_CheckHeader(&pcxh) ) {
+		PCX_GetFormat(&pcxh, image);
+		status = -1;
+		if ( (image->w > 0) && (image->h > 0) &&
+		     (image->w <= 16384) && (image->h <= 16384) ) {
+			image->pixels = (Uint8 *)calloc(image->h, image->pitch);
+			if ( image->pixels ) {
+				status = PCX_DecodeImage(&pcxh, data + sizeof(pcxh),
+				                         (int)(size - sizeof(pcxh)),
+				                         image->pixels, image->pitch,
+				                         image->h, image->colors);
+				if ( status < 0 ) {
+					free(image->pixels);
+					image->pixels = NULL;
+				}
+			}
+		}
+	}
+	munmap(data, size);
+	return(status);
+}
+
+SDL_Surface *sdl_LoadPCX(const char *filename)
+{
+  SDL_Surface *surface;
+  SDL_RWops *src;
+  int mapped;
+
+  surface = PCX_LoadMapped(filename, &mapped);
+  if(mapped) {
+    return surface;
+  }
+
+  /* Files which can't be mapped are read through SDL */
+  surface = NULL;
+  src = SDL_RWFromFile(filename,"rb");
+  if(src) {
+    if(IMG_isPCX(src)) {
+      SDL_RWseek(src, 0, SEEK_SET);
+      surface = IMG_LoadPCX_RW(src);
+    }
+    SDL_RWclose(src);
+  }
+  return surface;
+}
+
+#ifdef STANDALONE	/* Decoder benchmark */
+
+#include <sys/time.h>
+
+/* The original decoder, which reads the data a byte at a time */
+static SDL_Surface *IMG_LoadPCX_RW_bytewise(SDL_RWops *src)
 {
 	struct PCXheader pcxh;
 	Uint32 Rmask;
@@ -57,20 +582,9 @@ static SDL_Surface *IMG_LoadPCX_RW(SDL_RWops *src)
 	int i, index, x, y;
 	int count;
 	Uint8 *row, ch;
-	int read_error;
-
-	/* Initialize the data we will clean up when we're done */
-	surface = NULL;
-	read_error = 0;
-
-	/* Check to make sure we have something to do */
-	if ( ! src ) {
-		goto done;
-	}
 
-	/* Read and convert the header */
 	if ( ! SDL_RWread(src, &pcxh, sizeof(pcxh), 1) ) {
-		goto done;
+		return(NULL);
 	}
 	pcxh.Xmin = SDL_SwapLE16(pcxh.Xmin);
 	pcxh.Ymin = SDL_SwapLE16(pcxh.Ymin);
@@ -78,10 +592,9 @@ static SDL_Surface *IMG_LoadPCX_RW(SDL_RWops *src)
 	pcxh.Ymax = SDL_SwapLE16(pcxh.Ymax);
 	pcxh.BytesPerLine = SDL_SwapLE16(pcxh.BytesPerLine);
 
-	/* Create the surface of the appropriate type */
 	width = (pcxh.Xmax - pcxh.Xmin) + 1;
 	height = (pcxh.Ymax - pcxh.Ymin) + 1;
-	Rmask = Gmask = Bmask = Amask = 0 ; 
+	Rmask = Gmask = Bmask = Amask = 0 ;
 	if ( pcxh.BitsPerPixel > 16 ) {
 		if ( SDL_BYTEORDER == SDL_LIL_ENDIAN ) {
 			Rmask = 0x000000FF;
@@ -98,19 +611,16 @@ static SDL_Surface *IMG_LoadPCX_RW(SDL_RWops *src)
 	surface = SDL_CreateRGBSurface(SDL_SWSURFACE, width, height,
 			pcxh.BitsPerPixel*pcxh.NPlanes,Rmask,Gmask,Bmask,Amask);
 	if ( surface == NULL ) {
-		SDL_SetError("Out of memory");
-		goto done;
+		return(NULL);
 	}
-
-	/* Decode the image to the surface */
 	for ( y=0; y<surface->h; ++y ) {
 		for ( i=0; i<pcxh.NPlanes; ++i ) {
 			row = (Uint8 *)surface->pixels + y*surface->pitch;
 			index = i;
 			for ( x=0; x<pcxh.BytesPerLine; ) {
 				if ( ! SDL_RWread(src, &ch, 1, 1) ) {
-					read_error = 1;
-					goto done;
+					SDL_FreeSurface(surface);
+					return(NULL);
 				}
 				if ( (ch & 0xC0) == 0xC0 ) {
 					count = ch & 0x3F;
@@ -126,62 +636,173 @@ static SDL_Surface *IMG_LoadPCX_RW(SDL_RWops *src)
 			}
 		}
 	}
-
-	/* Look for the palette, if necessary */
-	switch (surface->format->BitsPerPixel) {
-	    case 1: {
+	if ( surface->format->BitsPerPixel == 8 ) {
 		SDL_Color *colors = surface->format->palette->colors;
 
-		colors[0].r = 0x00;
-		colors[0].g = 0x00;
-		colors[0].b = 0x00;
-		colors[1].r = 0xFF;
-		colors[1].g = 0xFF;
-		colors[1].b = 0xFF;
-	    }
-	    break;
-
-	    case 8: {
-		SDL_Color *colors = surface->format->palette->colors;
-
-		/* Look for the palette */
 		do {
 			if ( ! SDL_RWread(src, &ch, 1, 1) ) {
-				read_error = 1;
-				goto done;
+				SDL_FreeSurface(surface);
+				return(NULL);
 			}
 		} while ( ch != 12 );
-
-		/* Set the image surface palette */
 		for ( i=0; i<256; ++i ) {
 			SDL_RWread(src, &colors[i].r, 1, 1);
 			SDL_RWread(src, &colors[i].g, 1, 1);
 			SDL_RWread(src, &colors[i].b, 1, 1);
 		}
-	    }
-	    break;
+	}
+	return(surface);
+}
 
-	    default: {
-		/* Don't do anything... */;
-	    }
-	    break;
+/* Run-length encode a plane of a scanline, the way paint programs do */
+static Uint8 *encode_plane(Uint8 *dst, const Uint8 *src, int len)
+{
+	int x, count;
+
+	for ( x=0; x<len; x+=count ) {
+		for ( count=1; (x+count < len) && (count < 63) &&
+		               (src[x+count] == src[x]); ++count )
+			;
+		if ( (count > 1) || ((src[x] & 0xC0) == 0xC0) ) {
+			*dst++ = 0xC0 | count;
+		}
+		*dst++ = src[x];
 	}
+	return(dst);
+}
 
-done:
-	if ( read_error ) {
-		SDL_FreeSurface(surface);
-		SDL_SetError("Error reading PCX data");
-		surface = NULL;
+/* Make a test image with a mix of runs and noise, like a typical sprite */
+static Uint8 *make_pcx(int w, int h, int nplanes, int *size)
+{
+	struct PCXheader pcxh;
+	Uint8 *data, *ptr, *line;
+	int bpl, x, y, i;
+
+	bpl = (w + 1) & ~1;
+	data = (Uint8 *)malloc(sizeof(pcxh) + h*bpl*nplanes*2 + 769);
+	line = (Uint8 *)malloc(bpl);
+	memset(&pcxh, 0, sizeof(pcxh));
+	pcxh.Manufacturer = 10;
+	pcxh.Version = 5;
+	pcxh.Encoding = 1;
+	pcxh.BitsPerPixel = 8;
+	pcxh.Xmax = SDL_SwapLE16(w - 1);
+	pcxh.Ymax = SDL_SwapLE16(h - 1);
+	pcxh.NPlanes = nplanes;
+	pcxh.BytesPerLine = SDL_SwapLE16(bpl);
+	memcpy(data, &pcxh, sizeof(pcxh));
+	ptr = data + sizeof(pcxh);
+	for ( y=0; y<h; ++y ) {
+		for ( i=0; i<nplanes; ++i ) {
+			for ( x=0; x<bpl; ++x ) {
+				if ( ((x / 32) + (y / 32)) & 1 ) {
+					line[x] = (x * 7 + y * 13 + i * 17) & 0xFF;
+				} else {
+					line[x] = ((x / 32) * 40 + i * 60) & 0xFF;
+				}
+			}
+			ptr = encode_plane(ptr, line, bpl);
+		}
 	}
-	return(surface);
+	if ( nplanes == 1 ) {
+		*ptr++ = 12;
+		for ( i=0; i<768; ++i ) {
+			*ptr++ = i / 3;
+		}
+	}
+	free(line);
+	*size = (ptr - data);
+	return(data);
 }
 
-SDL_Surface *sdl_LoadPCX(const char *filename)
+static double now(void)
 {
-  SDL_RWops *src = SDL_RWFromFile(filename,"rb");
-  if(IMG_isPCX(src)) {
-    SDL_RWseek(src, 0, SEEK_SET);
-	return IMG_LoadPCX_RW(src);
-  }
-  return NULL;
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return(tv.tv_sec + tv.tv_usec / 1000000.0);
+}
+
+typedef SDL_Surface *(*pcx_loader)(SDL_RWops *src);
+
+/* Load the image repeatedly and return the decoding speed in MB/s */
+static double benchmark(pcx_loader load, Uint8 *data, int size, int iterations,
+                        SDL_Surface **result)
+{
+	SDL_Surface *surface;
+	SDL_RWops *src;
+	double start, elapsed;
+	int i;
+
+	*result = NULL;
+	surface = NULL;
+	start = now();
+	for ( i=0; i<iterations; ++i ) {
+		src = SDL_RWFromMem(data, size);
+		surface = load(src);
+		SDL_RWclose(src);
+		if ( ! surface ) {
+			return(0.0);
+		}
+		if ( i < (iterations - 1) ) {
+			SDL_FreeSurface(surface);
+		}
+	}
+	elapsed = now() - start;
+	*result = surface;
+	return((double)surface->pitch * surface->h * iterations /
+	       (elapsed * 1024.0 * 1024.0));
+}
+
+static int same_image(SDL_Surface *a, SDL_Surface *b)
+{
+	int y;
+
+	if ( ! a || ! b || (a->w != b->w) || (a->h != b->h) ||
+	     (a->format->BitsPerPixel != b->format->BitsPerPixel) ) {
+		return(0);
+	}
+	for ( y=0; y<a->h; ++y ) {
+		if ( memcmp((Uint8 *)a->pixels + y*a->pitch,
+		            (Uint8 *)b->pixels + y*b->pitch,
+		            a->w*a->format->BytesPerPixel) != 0 ) {
+			return(0);
+		}
+	}
+	if ( a->format->palette &&
+	     (memcmp(a->format->palette->colors, b->format->palette->colors,
+	             256*sizeof(SDL_Color)) != 0) ) {
+		return(0);
+	}
+	return(1);
+}
+
+int main(int argc, char *argv[])
+{
+	SDL_Surface *old_surface, *new_surface;
+	double old_rate, new_rate;
+	Uint8 *data;
+	int nplanes, size, status;
+
+	status = 0;
+	for ( nplanes=1; nplanes<=3; nplanes+=2 ) {
+		data = make_pcx(640, 480, nplanes, &size);
+		old_rate = benchmark(IMG_LoadPCX_RW_bytewise, data, size, 20,
+		                     &old_surface);
+		new_rate = benchmark(IMG_LoadPCX_RW, data, size, 20,
+		                     &new_surface);
+		printf("%2d-bit: bytewise %8.1f MB/s, buffered %8.1f MB/s (%.1fx)%s\n",
+		       nplanes*8, old_rate, new_rate,
+		       old_rate > 0.0 ? new_rate / old_rate : 0.0,
+		       same_image(old_surface, new_surface) ? "" : " MISMATCH");
+		if ( ! same_image(old_surface, new_surface) ) {
+			status = 1;
+		}
+		SDL_FreeSurface(old_surface);
+		SDL_FreeSurface(new_surface);
+		free(data);
+	}
+	return(status);
 }
+
+#endif /* STANDALONE */
@@ -0,0 +1,607 @@
+/*
+    Loki Game Utility Functions
+    Copyright (C) 1999  Loki Software, Inc.
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Library General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Library General Public License for more details.
+
+    You should have received a copy of the GNU Library General Public
+    License along with this library; if not, write to the Free
+    Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Screen snapshots.  The screen is copied on the calling thread, and then
+   encoded and written to disk on a background thread, so that taking a
+   snapshot doesn't make the game hitch.
+
+   The file format is taken from the "snapshotformat" configuration key,
+   which can be "bmp" (the default), "tga" for run-length encoded Targa
+   files, or "png" if the library was built with ZLIB=true.  The PNG
+   compression level is taken from "snapshotlevel", and defaults to the
+   fastest.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "SDL.h"
+#include "SDL_thread.h"
+#include "loki_utils.h"
+#include "loki_config.h"
+#include "sdl_utils.h"
+#include "sdl_decode.h"
+
+/* The most snapshots waiting to be written before we wait for the disk */
+#define MAX_PENDING_SHOTS   4
+
+typedef struct snapshot {
+    char path[PATH_MAX];
+    int format;
+    int level;
+    sdl_pixels image;
+    struct snapshot *next;
+} snapshot;
+
+static snapshot *shots_head = NULL;
+static snapshot *shots_tail = NULL;
+static int shots_pending = 0;       /* Queued or being written */
+static int shot_index = 0;          /* The next free number, once scanned */
+static int shot_quit = 0;
+static SDL_mutex *shot_lock = NULL;
+static SDL_cond *shot_cond = NULL;
+static SDL_Thread *shot_thread = NULL;
+
+/* Find the number after the highest numbered snapshot already saved */
+static int sdl_ScanSnapShots(const char *prefix)
+{
+    DIR *dir;
+    struct dirent *entry;
+    const char *name;
+    char *end;
+    int len, num, next;
+
+    next = 1;
+    len = strlen(prefix);
+    dir = opendir(loki_getprefpath());
+    if ( dir ) {
+        while ( (entry = readdir(dir)) != NULL ) {
+            name = entry->d_name;
+            if ( (strncmp(name, prefix, len) == 0) && isdigit(name[len]) ) {
+                num = strtol(name + len, &end, 10);
+                if ( (*end == '.') && (num >= next) ) {
+                    next = num + 1;
+                }
+            }
+        }
+        closedir(dir);
+    }
+    return(next);
+}
+
+/* Convert a row of pixels in any format to 24-bit RGB */
+static void sdl_GetRGBRow(const sdl_pixels *image, int y, Uint8 *rgb)
+{
+    const Uint32 masks[3] = { image->Rmask, image->Gmask, image->Bmask };
+    int shift[3], loss[3];
+    const Uint8 *src;
+    Uint32 pixel, mask;
+    int x, i;
+
+    src = image->pixels + y * image->pitch;
+    if ( image->bpp == 8 ) {
+        for ( x=0; x<image->w; ++x ) {
+            *rgb++ = image->colors[src[x]].r;
+            *rgb++ = image->colors[src[x]].g;
+            *rgb++ = image->colors[src[x]].b;
+        }
+        return;
+    }
+
+    for ( i=0; i<3; ++i ) {
+        mask = masks[i];
+        shift[i] = 0;
+        loss[i] = 8;
+        if ( mask ) {
+            while ( ! (mask & 1) ) {
+                mask >>= 1;
+                ++shift[i];
+            }
+            while ( mask & 1 ) {
+                mask >>= 1;
+                --loss[i];
+            }
+            if ( loss[i] < 0 ) {
+                loss[i] = 0;
+            }
+        }
+    }
+    for ( x=0; x<image->w; ++x ) {
+        switch (image->bpp) {
+            case 15:
+            case 16:
+                pixel = ((const Uint16 *)src)[x];
+                break;
+            case 24:
+                if ( SDL_BYTEORDER == SDL_LIL_ENDIAN ) {
+                    pixel = src[x*3] | (src[x*3+1] << 8) | (src[x*3+2] << 16);
+                } else {
+                    pixel = (src[x*3] << 16) | (src[x*3+1] << 8) | src[x*3+2];
+                }
+                break;
+            default:
+                pixel = ((const Uint32 *)src)[x];
+                break;
+        }
+        for ( i=0; i<3; ++i ) {
+            *rgb++ = ((pixel & masks[i]) >> shift[i]) << loss[i];
+        }
+    }
+}
+
+static void sdl_PutLE16(Uint8 *p, Uint16 value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+}
+
+static void sdl_PutLE32(Uint8 *p, Uint32 value)
+{
+    p[0] = value & 0xFF;
+    p[1] = (value >> 8) & 0xFF;
+    p[2] = (value >> 16) & 0xFF;
+    p[3] = (value >> 24) & 0xFF;
+}
+
+/* Write an image as a 24-bit uncompressed BMP file */
+static int sdl_WriteBMP(FILE *fp, const sdl_pixels *image, int level)
+{
+    Uint8 header[54], *row, tmp;
+    int rowlen, x, y, status;
+
+    rowlen = (image->w * 3 + 3) & ~3;
+    row = (Uint8 *)calloc(1, rowlen);
+    if ( ! row ) {
+        return(-1);
+    }
+    memset(header, 0, sizeof(header));
+    header[0] = 'B';
+    header[1] = 'M';
+    sdl_PutLE32(header + 2, sizeof(header) + rowlen * image->h);
+    sdl_PutLE32(header + 10, sizeof(header));
+    sdl_PutLE32(header + 14, 40);
+    sdl_PutLE32(header + 18, image->w);
+    sdl_PutLE32(header + 22, image->h);
+    sdl_PutLE16(header + 26, 1);
+    sdl_PutLE16(header + 28, 24);
+    sdl_PutLE32(header + 34, rowlen * image->h);
+    status = (fwrite(header, sizeof(header), 1, fp) == 1) ? 0 : -1;
+
+    /* The rows are stored bottom up, with the blue first */
+    for ( y=image->h-1; (y >= 0) && (status == 0); --y ) {
+        sdl_GetRGBRow(image, y, row);
+        for ( x=0; x<image->w; ++x ) {
+            tmp = row[x*3];
+            row[x*3] = row[x*3+2];
+            row[x*3+2] = tmp;
+        }
+        if ( fwrite(row, rowlen, 1, fp) != 1 ) {
+            status = -1;
+        }
+    }
+    free(row);
+    return(status);
+}
+
+/* Write an image as a 24-bit run-length encoded Targa file */
+static int sdl_WriteTGA(FILE *fp, const sdl_pixels *image, int level)
+{
+    Uint8 header[18], *row, *out, *ptr;
+    int x, n, i, y, status;
+
+    row = (Uint8 *)malloc(image->w * 3);
+    /* The worst case is a packet header for every 128 pixels */
+    out = (Uint8 *)malloc(image->w * 3 + (image->w + 127) / 128);
+    if ( ! row || ! out ) {
+        free(row);
+        free(out);
+        return(-1);
+    }
+    memset(header, 0, sizeof(header));
+    header[2] = 10;                 /* Run-length encoded true color */
+    sdl_PutLE16(header + 12, image->w);
+    sdl_PutLE16(header + 14, image->h);
+    header[16] = 24;
+    header[17] = 0x20;              /* Top to bottom */
+    status = (fwrite(header, sizeof(header), 1, fp) == 1) ? 0 : -1;
+
+    /* Packets don't cross rows, as the specification recommends */
+    for ( y=0; (y < image->h) && (status == 0); ++y ) {
+        sdl_GetRGBRow(image, y, row);
+        ptr = out;
+        for ( x=0; x<image->w; x += n ) {
+            /* See how many times this pixel repeats */
+            for ( n=1; (x+n < image->w) && (n < 128) &&
+                       (memcmp(row+x*3, row+(x+n)*3, 3) == 0); ++n )
+                ;
+            if ( n > 1 ) {
+                *ptr++ = 0x80 | (n - 1);
+                *ptr++ = row[x*3+2];
+                *ptr++ = row[x*3+1];
+                *ptr++ = row[x*3];
+                continue;
+            }
+            /* Collect pixels up to the start of the next run */
+            for ( n=1; (x+n < image->w) && (n < 128); ++n ) {
+                if ( (x+n+1 < image->w) &&
+                     (memcmp(row+(x+n)*3, row+(x+n+1)*3, 3) == 0) ) {
+                    break;
+                }
+            }
+            *ptr++ = n - 1;
+            for ( i=0; i<n; ++i ) {
+                *ptr++ = row[(x+i)*3+2];
+                *ptr++ = row[(x+i)*3+1];
+                *ptr++ = row[(x+i)*3];
+            }
+        }
+        if ( fwrite(out, ptr - out, 1, fp) != 1 ) {
+            status = -1;
+        }
+    }
+    free(row);
+    free(out);
+    return(status);
+}
+
+#ifdef HAVE_ZLIB
+static void sdl_PutBE32(Uint8 *p, Uint32 value)
+{
+    p[0] = (value >> 24) & 0xFF;
+    p[1] = (value >> 16) & 0xFF;
+    p[2] = (value >> 8) & 0xFF;
+    p[3] = value & 0xFF;
+}
+
+static int sdl_WritePNGChunk(FILE *fp, const char *type,
+                             const Uint8 *data, Uint32 len)
+{
+    Uint8 buf[8];
+    uLong crc;
+
+    sdl_PutBE32(buf, len);
+    memcpy(buf + 4, type, 4);
+    crc = crc32(0L, buf + 4, 4);
+    if ( len ) {
+        crc = crc32(crc, data, len);
+    }
+    if ( (fwrite(buf, 8, 1, fp) != 1) ||
+         (len && (fwrite(data, len, 1, fp) != 1)) ) {
+        return(-1);
+    }
+    sdl_PutBE32(buf, crc);
+    return((fwrite(buf, 4, 1, fp) == 1) ? 0 : -1);
+}
+
+/* Write an image as a 24-bit PNG file, compressed at 'level' */
+static int sdl_WritePNG(FILE *fp, const sdl_pixels *image, int level)
+{
+    static const Uint8 signature[8] = {
+        0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'
+    };
+    Uint8 header[13], out[65536], *row;
+    z_stream zs;
+    int rowlen, x, y, status, flush, result;
+
+    rowlen = 1 + image->w * 3;
+    row = (Uint8 *)malloc(rowlen);
+    if ( ! row ) {
+        return(-1);
+    }
+    memset(&zs, 0, sizeof(zs));
+    if ( deflateInit(&zs, level) != Z_OK ) {
+        free(row);
+        return(-1);
+    }
+
+    sdl_PutBE32(header, image->w);
+    sdl_PutBE32(header + 4, image->h);
+    header[8] = 8;                  /* Bits per sample */
+    header[9] = 2;                  /* Truecolor */
+    header[10] = 0;                 /* Deflate */
+    header[11] = 0;                 /* Adaptive filtering */
+    header[12] = 0;                 /* No interlace */
+    status = 0;
+    if ( (fwrite(signature, sizeof(signature), 1, fp) != 1) ||
+         (sdl_WritePNGChunk(fp, "IHDR", header, sizeof(header)) < 0) ) {
+        status = -1;
+    }
+
+    /* Each row uses the "sub" filter, which turns flat areas into zeros */
+    zs.next_out = out;
+    zs.avail_out = sizeof(out);
+    for ( y=0; (y <= image->h) && (status == 0); ++y ) {
+        if ( y < image->h ) {
+            sdl_GetRGBRow(image, y, row + 1);
+            row[0] = 1;
+            for ( x=rowlen-1; x>3; --x ) {
+                row[x] -= row[x-3];
+            }
+            zs.next_in = row;
+            zs.avail_in = rowlen;
+            flush = Z_NO_FLUSH;
+        } else {
+            zs.avail_in = 0;
+            flush = Z_FINISH;
+        }
+        do {
+            result = deflate(&zs, flush);
+            if ( result == Z_STREAM_ERROR ) {
+                status = -1;
+                break;
+            }
+            /* Write out the compressed data a buffer full at a time */
+            if ( (zs.avail_out == 0) || (result == Z_STREAM_END) ) {
+                if ( sdl_WritePNGChunk(fp, "IDAT", out,
+                                       sizeof(out) - zs.avail_out) < 0 ) {
+                    status = -1;
+                    break;
+                }
+                zs.next_out = out;
+                zs.avail_out = sizeof(out);
+            }
+        } while ( (zs.avail_in > 0) ||
+                  ((flush == Z_FINISH) && (result != Z_STREAM_END)) );
+    }
+    deflateEnd(&zs);
+    free(row);
+
+    if ( (status == 0) && (sdl_WritePNGChunk(fp, "IEND", NULL, 0) < 0) ) {
+        status = -1;
+    }
+    return(status);
+}
+#endif /* HAVE_ZLIB */
+
+/* The snapshot file formats, the name is used as the file extension */
+static const struct {
+    const char *name;
+    int (*write)(FILE *fp, const sdl_pixels *image, int level);
+} shot_formats[] = {
+    { "bmp", sdl_WriteBMP },
+    { "tga", sdl_WriteTGA },
+#ifdef HAVE_ZLIB
+    { "png", sdl_WritePNG },
+#endif
+};
+#define NUM_SHOT_FORMATS    (sizeof(shot_formats)/sizeof(shot_formats[0]))
+
+static void sdl_WriteSnapShot(snapshot *shot)
+{
+    FILE *fp;
+    int status;
+
+    fp = fopen(shot->path, "wb");
+    if ( ! fp ) {
+        perror(shot->path);
+        return;
+    }
+    status = shot_formats[shot->format].write(fp, &shot->image, shot->level);
+    if ( fclose(fp) != 0 ) {
+        status = -1;
+    }
+    if ( status < 0 ) {
+        fprintf(stderr, "Couldn't write snapshot %s\n", shot->path);
+        unlink(shot->path);
+    }
+}
+
+static void sdl_FreeSnapShot(snapshot *shot)
+{
+    free(shot->image.pixels);
+    free(shot);
+}
+
+static int sdl_SnapShotWriter(void *unused)
+{
+    snapshot *shot;
+
+    SDL_mutexP(shot_lock);
+    for ( ;; ) {
+        while ( ! shots_head && ! shot_quit ) {
+            SDL_CondWait(shot_cond, shot_lock);
+        }
+        shot = shots_head;
+        if ( ! shot ) {
+            break;
+        }
+        shots_head = shot->next;
+        if ( ! shots_head ) {
+            shots_tail = NULL;
+        }
+        SDL_mutexV(shot_lock);
+
+        sdl_WriteSnapShot(shot);
+        sdl_FreeSnapShot(shot);
+
+        SDL_mutexP(shot_lock);
+        --shots_pending;
+        SDL_CondBroadcast(shot_cond);
+    }
+    SDL_mutexV(shot_lock);
+    return(0);
+}
+
+/* Write out any queued snapshots and stop the writer thread at exit */
+static void sdl_StopSnapShots(void)
+{
+    if ( shot_thread ) {
+        SDL_mutexP(shot_lock);
+        shot_quit = 1;
+        SDL_CondBroadcast(shot_cond);
+        SDL_mutexV(shot_lock);
+        SDL_WaitThread(shot_thread, NULL);
+        shot_thread = NULL;
+    }
+}
+
+static int sdl_StartSnapShots(void)
+{
+    if ( shot_thread ) {
+        return(0);
+    }
+    if ( ! shot_lock ) {
+        shot_lock = SDL_CreateMutex();
+        shot_cond = SDL_CreateCond();
+        if ( ! shot_lock || ! shot_cond ) {
+            return(-1);
+        }
+    }
+    shot_quit = 0;
+    shot_thread = SDL_CreateThread(sdl_SnapShotWriter, NULL);
+    if ( ! shot_thread ) {
+        return(-1);
+    }
+    atexit(sdl_StopSnapShots);
+    return(0);
+}
+
+void sdl_FlushSnapShots(void)
+{
+    if ( shot_thread ) {
+        SDL_mutexP(shot_lock);
+        while ( shots_pending > 0 ) {
+            SDL_CondWait(shot_cond, shot_lock);
+        }
+        SDL_mutexV(shot_lock);
+    }
+}
+
+/* Copy the screen pixels and format, so the screen can be drawn again */
+static int sdl_CopyScreen(SDL_Surface *screen, sdl_pixels *image)
+{
+    SDL_PixelFormat *format;
+    int i;
+
+    if ( ! screen->pixels && ! SDL_MUSTLOCK(screen) ) {
+        SDL_SetError("The screen pixels can't be read");
+        return(-1);
+    }
+    format = screen->format;
+    image->w = screen->w;
+    image->h = screen->h;
+    image->bpp = format->BitsPerPixel;
+    image->pitch = screen->pitch;
+    image->Rmask = format->Rmask;
+    image->Gmask = format->Gmask;
+    image->Bmask = format->Bmask;
+    image->Amask = format->Amask;
+    image->ncolors = 0;
+    if ( format->palette ) {
+        image->ncolors = format->palette->ncolors;
+        if ( image->ncolors > 256 ) {
+            image->ncolors = 256;
+        }
+        for ( i=0; i<image->ncolors; ++i ) {
+            image->colors[i] = format->palette->colors[i];
+        }
+    }
+    image->pixels = (Uint8 *)malloc(screen->h * screen->pitch);
+    if ( ! image->pixels ) {
+        SDL_SetError("Out of memory");
+        return(-1);
+    }
+    if ( SDL_MUSTLOCK(screen) && (SDL_LockSurface(screen) < 0) ) {
+        free(image->pixels);
+        return(-1);
+    }
+    memcpy(image->pixels, screen->pixels, screen->h * screen->pitch);
+    if ( SDL_MUSTLOCK(screen) ) {
+        SDL_UnlockSurface(screen);
+    }
+    return(0);
+}
+
+void sdl_SnapShot(SDL_Surface *screen)
+{
+    char prefix[100], filename[128];
+    const char *value;
+    snapshot *shot;
+    int i;
+
+    if ( ! screen ) {
+        screen = SDL_GetVideoSurface();
+    }
+
+    if ( ! screen ) return;
+
+    /* Only look at the disk the first time, after that count in memory */
+    snprintf(prefix, sizeof(prefix), "%s_shot", loki_getgamename());
+    if ( ! shot_index ) {
+        shot_index = sdl_ScanSnapShots(prefix);
+    }
+    shot = (snapshot *)malloc(sizeof(*shot));
+    if ( ! shot ) {
+        return;
+    }
+
+    /* The configuration is read here, since it isn't safe on other threads */
+    shot->format = 0;
+    value = loki_getconfig_str("snapshotformat");
+    if ( value ) {
+        for ( i=0; i<NUM_SHOT_FORMATS; ++i ) {
+            if ( strcasecmp(value, shot_formats[i].name) == 0 ) {
+                shot->format = i;
+                break;
+            }
+        }
+    }
+    shot->level = 1;
+    value = loki_getconfig_str("snapshotlevel");
+    if ( value && isdigit(*value) && (atoi(value) <= 9) ) {
+        shot->level = atoi(value);
+    }
+    snprintf(filename, sizeof(filename), "%s%d.%s",
+             prefix, shot_index++, shot_formats[shot->format].name);
+    loki_getpreffile(filename, shot->path, sizeof(shot->path));
+    if ( sdl_CopyScreen(screen, &shot->image) < 0 ) {
+        free(shot);
+        return;
+    }
+
+    /* Write it ourselves if we can't do it in the background */
+    if ( sdl_StartSnapShots() < 0 ) {
+        sdl_WriteSnapShot(shot);
+        sdl_FreeSnapShot(shot);
+        return;
+    }
+
+    SDL_mutexP(shot_lock);
+    while ( shots_pending >= MAX_PENDING_SHOTS ) {
+        SDL_CondWait(shot_cond, shot_lock);
+    }
+    shot->next = NULL;
+    if ( shots_tail ) {
+        shots_tail->next = shot;
+    } else {
+        shots_head = shot;
+    }
+    shots_tail = shot;
+    ++shots_pending;
+    SDL_CondBroadcast(shot_cond);
+    SDL_mutexV(shot_lock);
+}
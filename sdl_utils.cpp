@@ -6,11 +6,14 @@
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <poll.h>
 
 #include "SDL.h"
 #include "SDL_syswm.h"
 #include "loki_utils.h"
 #include "sdl_utils.h"
+#include "sdl_decode.h"
 
 #ifndef LOKI_NO_GLMSG
 #include "loki_glmessage.h"
@@ -20,6 +23,9 @@
 
 #ifdef unix
 #include <X11/Xutil.h>
+#ifdef HAVE_XFIXES
+#include <X11/extensions/Xfixes.h>
+#endif
 #endif
 
 #ifdef __cplusplus
@@ -29,10 +35,13 @@ extern "C" {
 #ifdef LOKI_NO_GLMSG
 typedef float GLfloat;
 #define loki_glmsg_initialize(bgr, bgg, bgb) fprintf(stderr, "No GLmsg support!\n")
-#define loki_glmsg_print(bgr, bgg, bgb, txt) fprintf(stderr, "GLmsg: %s\n", txt)
+#define loki_glmsg_printline(bgr, bgg, bgb, txt, len) \
+    fprintf(stderr, "GLmsg: %.*s\n", len, txt)
+#define loki_glmsg_getfont(scale) loki_2dmsg_getfont(scale)
 #endif
 
-static inline void sdl_showmsg_print(float, float, float, const char *);
+// More lines than this won't fit on any screen.
+#define MAX_MESSAGE_LINES   256
 
 
 static inline void sdl_showmsg_initialize(float bgr, float bgg, float bgb)
@@ -40,41 +49,33 @@ static inline void sdl_showmsg_initialize(float bgr, float bgg, float bgb)
     if (SDL_GetVideoSurface()->flags & SDL_OPENGL)
         loki_glmsg_initialize(bgr, bgg, bgb);
     else
+    {
         loki_2dmsg_initialize(bgr, bgg, bgb);
+        loki_2dmsg_queue();
+    } // else
 }
 
-static inline void sdl_showmsg_splitprint(GLfloat r, GLfloat g, GLfloat b,
-                                            const char *str)
+static inline void sdl_showmsg_update(void)
 {
-    SDL_Surface *surface = SDL_GetVideoSurface();
-    int chars_per_line = (surface->w / 10) - 2;   // minus two for spacing.
-    int len = strlen(str);
-    char buffer[len + 1];
-    int i;
-
-    for (i = 0; i < len; i += chars_per_line)
-    {
-        strcpy(buffer, str + i);
-        buffer[chars_per_line] = '\0';
-        sdl_showmsg_print(r, g, b, buffer);
-    } // for
+    if (!(SDL_GetVideoSurface()->flags & SDL_OPENGL))
+        loki_2dmsg_update();
 }
 
-static inline void sdl_showmsg_print(float r, float g, float b, const char *str)
+static inline const loki_font *sdl_showmsg_getfont(int *scale)
 {
-    SDL_Surface *surface = SDL_GetVideoSurface();
-    int textw = ((int) surface->w - ((int) (strlen(str) * 10))) / 2;
-
-    if (textw < 0)
-    {
-        sdl_showmsg_splitprint(r, g, b, str);
-        return;
-    } // if
+    if (SDL_GetVideoSurface()->flags & SDL_OPENGL)
+        return(loki_glmsg_getfont(scale));
+    else
+        return(loki_2dmsg_getfont(scale));
+}
 
+static inline void sdl_showmsg_printline(float r, float g, float b,
+                                         const char *str, int len)
+{
     if (SDL_GetVideoSurface()->flags & SDL_OPENGL)
-        loki_glmsg_print(r, g, b, str);
+        loki_glmsg_printline(r, g, b, str, len);
     else
-        loki_2dmsg_print(r, g, b, str);
+        loki_2dmsg_printline(r, g, b, str, len);
 }
 
 //----------------------
@@ -84,44 +85,61 @@ static inline void sdl_showmsg_print(float r, float g, float b, const char *str)
 void sdl_ShowMessage(const char *fmt, ...)
 {
     char buffer[1024];
-    int totallines = 0;
-    char *nextnl = buffer;
-    char *str = buffer;
-    int screenlines = (SDL_GetVideoSurface()->h / 15);      // 15 pixels/line
-    int screenwidth = (SDL_GetVideoSurface()->h / 10) - 2;  // -2 for spacing
+    char *text = buffer;
+    loki_textline lines[MAX_MESSAGE_LINES];
+    SDL_Surface *surface = SDL_GetVideoSurface();
+    const loki_font *font;
+    int scale;
+    int width;
+    int totallines;
+    int screenlines;
+    int len;
+    int i;
     va_list ap;
 
     va_start(ap, fmt);
-    vsnprintf(buffer, sizeof (buffer), fmt, ap);
+    len = vsnprintf(buffer, sizeof (buffer), fmt, ap);
     va_end(ap);
 
-    sdl_showmsg_initialize(0.0, 0.0, 0.0);
-
-    do
+    // long messages are formatted again into a buffer big enough for them.
+    if (len >= (int) sizeof (buffer))
     {
-        nextnl = strchr(str, '\n');
-        if (nextnl != NULL)
+        text = (char *) malloc(len + 1);
+        if (text == NULL)
+            text = buffer;
+        else
         {
-            totallines += ( ((int) (nextnl - str)) / screenwidth ) + 1;
-            str = nextnl + 1;
-        } // if
-    } while (nextnl != NULL);
+            va_start(ap, fmt);
+            vsnprintf(text, len + 1, fmt, ap);
+            va_end(ap);
+        } // else
+    } // if
 
-    for (int i = (screenlines - totallines) / 2; i >= 0; i--)
-        sdl_showmsg_print(0.0, 0.0, 0.0, "");
+    sdl_showmsg_initialize(0.0, 0.0, 0.0);
+
+    // wrap the lines to the screen, leaving the width of a space each side.
+    font = sdl_showmsg_getfont(&scale);
+    width = (surface->w / scale) - (2 * loki_font_textwidth(font, " ", 1));
+    totallines = loki_font_wraptext(font, text, width,
+                                    lines, MAX_MESSAGE_LINES);
+    screenlines = surface->h / (font->height * scale);
+
+    for (i = (screenlines - totallines) / 2; i >= 0; i--)
+        sdl_showmsg_printline(0.0, 0.0, 0.0, "", 0);
 
     // okay, message is centered vertically...write it out.
 
-    str = buffer;
+    if (totallines > MAX_MESSAGE_LINES)
+        totallines = MAX_MESSAGE_LINES;
 
-    do
-    {
-        nextnl = strchr(str, '\n');
-        if (nextnl != NULL)
-            *nextnl = '\0';
-        sdl_showmsg_print(1.0, 1.0, 1.0, str);
-        str = nextnl + 1;
-    } while (nextnl != NULL);
+    for (i = 0; i < totallines; i++)
+        sdl_showmsg_printline(1.0, 1.0, 1.0, lines[i].text, lines[i].len);
+
+    // send the whole message to the screen at once.
+    sdl_showmsg_update();
+
+    if (text != buffer)
+        free(text);
 }
 
 
@@ -255,11 +273,357 @@ void sdl_ToggleConfineMouse(void)
     }
 }
 
+/* The most time to wait for the selection owner to send more text */
+#define CLIPBOARD_TIMEOUT   1000
+
+/* The selection is read this many 32-bit units at a time */
+#define CLIPBOARD_CHUNK     16384
+
+/* When sdl_ClipboardFilter() is the event filter, it reads the selection
+   as the SelectionNotify and PropertyNotify events for it come in, and
+   sdl_GetClipboard() returns the last text read without waiting.  With
+   XFixes the text is read again whenever the selection owner changes,
+   otherwise each sdl_GetClipboard() call starts reading it again for the
+   next one.  Without the filter, sdl_GetClipboard() waits for the text,
+   taking only the events for our window.  Large selections come in pieces
+   with the INCR protocol.
+ */
+typedef struct {
+    Display *display;
+    Window window;
+    Atom property;          /* Where the owner puts the text for us */
+    Atom incr;
+    int owned;              /* This program owns XA_PRIMARY */
+    int current;            /* The text is from the latest owner (XFixes) */
+    int pending;            /* Waiting for the owner to send the text */
+    int refetch;            /* Ask again once the text comes in */
+    int incr_active;        /* The text is coming in pieces */
+    long event_mask;        /* The window's events before the pieces */
+    Uint32 last_ticks;      /* When the owner last sent something */
+    char *incoming;
+    unsigned long incoming_len;
+    unsigned long incoming_size;
+#ifdef HAVE_XFIXES
+    int xfixes_event;       /* The XFixesSelectionNotify event type, or 0 */
+#endif
+} sdl_clipboard;
+
 static char *clipboard = NULL;
+static sdl_clipboard clip;
+
+/* Read a property as text, adding it to the incoming text.
+   Returns the number of bytes read, or -1 if the property isn't text.
+   'type' is set to the type of the property, None if there isn't one.
+ */
+static long sdl_ReadClipboardProperty(Window window, Atom property,
+                                      Bool remove, Atom *type)
+{
+    int format;
+    unsigned long nitems;
+    unsigned long bytes_after;
+    unsigned long offset;
+    unsigned long size;
+    unsigned char *data;
+    char *text;
+    long total;
+
+    total = 0;
+    offset = 0;
+    do {
+        data = NULL;
+        if ( XGetWindowProperty(clip.display, window, property, offset,
+                 CLIPBOARD_CHUNK, False, AnyPropertyType, type, &format,
+                 &nitems, &bytes_after, &data) != Success ) {
+            *type = None;
+            return(-1);
+        }
+        if ( (*type != XA_STRING) || (format != 8) ) {
+            if ( data ) {
+                XFree(data);
+            }
+            total = -1;
+            break;
+        }
+        if ( clip.incoming_len + nitems + 1 > clip.incoming_size ) {
+            size = (clip.incoming_size * 2) + nitems + 1;
+            text = (char *)realloc(clip.incoming, size);
+            if ( ! text ) {
+                XFree(data);
+                total = -1;
+                break;
+            }
+            clip.incoming = text;
+            clip.incoming_size = size;
+        }
+        memcpy(clip.incoming + clip.incoming_len, data, nitems);
+        clip.incoming_len += nitems;
+        clip.incoming[clip.incoming_len] = '\0';
+        total += nitems;
+        offset += nitems / 4;
+        XFree(data);
+    } while ( bytes_after > 0 );
+
+    if ( remove ) {
+        XDeleteProperty(clip.display, window, property);
+    }
+    return(total);
+}
+
+static void sdl_FetchClipboard(void);
+
+/* Make the incoming text the clipboard text, or drop it if failed */
+static void sdl_FinishClipboard(int success)
+{
+    if ( success ) {
+        if ( ! clip.incoming ) {
+            clip.incoming = (char *)malloc(1);
+            if ( clip.incoming ) {
+                *clip.incoming = '\0';
+            }
+        }
+        free(clipboard);
+        clipboard = clip.incoming;
+        clip.current = 1;
+    } else {
+        free(clip.incoming);
+    }
+    clip.incoming = NULL;
+    clip.incoming_len = 0;
+    clip.incoming_size = 0;
+    if ( clip.incr_active ) {
+        XSelectInput(clip.display, clip.window, clip.event_mask);
+        clip.incr_active = 0;
+    }
+    clip.pending = 0;
+    if ( clip.refetch ) {
+        clip.refetch = 0;
+        sdl_FetchClipboard();
+    }
+}
+
+/* Give up on the text being sent, any reply to come is ignored */
+static void sdl_DropClipboard(void)
+{
+    clip.refetch = 0;
+    sdl_FinishClipboard(0);
+}
+
+/* Ask the selection owner for the text, this doesn't wait for a reply.
+   Only one request is made at a time, so that a reply can't be taken
+   for the reply to a later request.
+ */
+static void sdl_FetchClipboard(void)
+{
+    clip.current = 0;
+    if ( clip.pending ) {
+        clip.refetch = 1;
+        return;
+    }
+    XConvertSelection(clip.display, XA_PRIMARY, XA_STRING,
+                      clip.property, clip.window, CurrentTime);
+    XFlush(clip.display);
+    clip.pending = 1;
+    clip.last_ticks = SDL_GetTicks();
+}
+
+/* See if an event is a reply to our request for the selection, and not
+   to a request the program made itself.
+ */
+static int sdl_IsClipboardReply(XEvent *xevent)
+{
+    switch (xevent->type) {
+        case SelectionNotify:
+            return((xevent->xselection.requestor == clip.window) &&
+                   (xevent->xselection.selection == XA_PRIMARY) &&
+                   (xevent->xselection.target == XA_STRING) &&
+                   ((xevent->xselection.property == clip.property) ||
+                    (xevent->xselection.property == None)));
+        case PropertyNotify:
+            return((xevent->xproperty.window == clip.window) &&
+                   (xevent->xproperty.atom == clip.property));
+        default:
+            return(0);
+    }
+}
+
+/* Handle the events for reading the selection.
+   Returns 1 if the event was one of them, or 0 if not.
+ */
+static int sdl_HandleClipboardEvent(XEvent *xevent)
+{
+    XWindowAttributes attributes;
+    Atom type;
+    long nbytes;
+
+    switch (xevent->type) {
+        /* The owner has put the text, or INCR, in our property */
+        case SelectionNotify: {
+            XSelectionEvent *sel;
+
+            sel = &xevent->xselection;
+            if ( ! clip.pending || clip.incr_active ||
+                 ! sdl_IsClipboardReply(xevent) ) {
+                return(0);
+            }
+            if ( sel->property == None ) {
+                /* Nobody has a selection, so use the cut buffer */
+                nbytes = sdl_ReadClipboardProperty(
+                            DefaultRootWindow(clip.display),
+                            XA_CUT_BUFFER0, False, &type);
+                sdl_FinishClipboard(nbytes >= 0);
+                return(1);
+            }
+            nbytes = sdl_ReadClipboardProperty(clip.window, clip.property,
+                                               False, &type);
+            if ( type == clip.incr ) {
+                /* Watch the property for the pieces while they come in,
+                   then deleting it asks for the first piece.
+                 */
+                XGetWindowAttributes(clip.display, clip.window, &attributes);
+                clip.event_mask = attributes.your_event_mask;
+                XSelectInput(clip.display, clip.window,
+                             clip.event_mask | PropertyChangeMask);
+                XDeleteProperty(clip.display, clip.window, clip.property);
+                clip.incoming_len = 0;
+                clip.incr_active = 1;
+                clip.last_ticks = SDL_GetTicks();
+            } else {
+                XDeleteProperty(clip.display, clip.window, clip.property);
+                sdl_FinishClipboard(nbytes >= 0);
+            }
+        }
+        return(1);
+
+        /* The next piece of an INCR transfer, an empty one ends it */
+        case PropertyNotify: {
+            XPropertyEvent *prop;
+
+            prop = &xevent->xproperty;
+            if ( ! clip.incr_active || ! sdl_IsClipboardReply(xevent) ||
+                 (prop->state != PropertyNewValue) ) {
+                return(0);
+            }
+            nbytes = sdl_ReadClipboardProperty(clip.window, clip.property,
+                                               True, &type);
+            if ( type == None ) {
+                return(1);
+            }
+            if ( nbytes > 0 ) {
+                clip.last_ticks = SDL_GetTicks();
+            } else {
+                sdl_FinishClipboard(nbytes == 0);
+            }
+        }
+        return(1);
+
+        /* Another program has taken the selection */
+        case SelectionClear:
+            if ( (xevent->xselectionclear.window != clip.window) ||
+                 (xevent->xselectionclear.selection != XA_PRIMARY) ) {
+                return(0);
+            }
+            clip.owned = 0;
+            clip.current = 0;
+            return(1);
+
+        default:
+#ifdef HAVE_XFIXES
+            if ( clip.xfixes_event && (xevent->type == clip.xfixes_event) ) {
+                XFixesSelectionNotifyEvent *notify;
+
+                notify = (XFixesSelectionNotifyEvent *)xevent;
+                if ( (notify->selection == XA_PRIMARY) &&
+                     (notify->owner != clip.window) ) {
+                    clip.owned = 0;
+                    sdl_FetchClipboard();
+                }
+                return(1);
+            }
+#endif
+            return(0);
+    }
+}
+
+/* See if sdl_ClipboardFilter() gets the events for reading the selection */
+static int sdl_ClipboardFiltered(void)
+{
+    return((SDL_GetEventFilter() == sdl_ClipboardFilter) &&
+           (SDL_EventState(SDL_SYSWMEVENT, SDL_QUERY) == SDL_ENABLE));
+}
+
+/* Pick out the events for reading the selection without the filter */
+static Bool sdl_IsClipboardEvent(Display *display, XEvent *xevent, XPointer arg)
+{
+    return(sdl_IsClipboardReply(xevent));
+}
+
+/* Read the selection now, leaving the other events for SDL */
+static void sdl_ReadClipboardNow(void)
+{
+    struct pollfd pfd;
+    XEvent xevent;
+
+    sdl_FetchClipboard();
+    while ( clip.pending ) {
+        if ( XCheckIfEvent(clip.display, &xevent, sdl_IsClipboardEvent, NULL) ) {
+            sdl_HandleClipboardEvent(&xevent);
+        } else if ( (SDL_GetTicks() - clip.last_ticks) >= CLIPBOARD_TIMEOUT ) {
+            sdl_DropClipboard();
+        } else {
+            pfd.fd = ConnectionNumber(clip.display);
+            pfd.events = POLLIN;
+            poll(&pfd, 1, 10);
+        }
+    }
+}
+
+/* Get ready to use the X11 clipboard, returns 0 if it isn't available */
+static int sdl_SetupClipboard(SDL_SysWMinfo *info)
+{
+    SDL_VERSION(&info->version);
+    if ( (SDL_GetWMInfo(info) <= 0) || (info->subsystem != SDL_SYSWM_X11) ) {
+        return(0);
+    }
+    if ( (info->info.x11.display == clip.display) &&
+         (info->info.x11.window == clip.window) ) {
+        return(1);
+    }
+
+    info->info.x11.lock_func();
+    if ( clip.pending ) {
+        /* The old window may be gone, so leave its events alone */
+        clip.incr_active = 0;
+        sdl_DropClipboard();
+    }
+    clip.display = info->info.x11.display;
+    clip.window = info->info.x11.window;
+    clip.property = XInternAtom(clip.display, "SDL_SELECTION", False);
+    clip.incr = XInternAtom(clip.display, "INCR", False);
+    clip.owned = 0;
+    clip.current = 0;
+
+#ifdef HAVE_XFIXES
+    {
+        int event_base, error_base;
+
+        clip.xfixes_event = 0;
+        if ( XFixesQueryExtension(clip.display, &event_base, &error_base) ) {
+            XFixesSelectSelectionInput(clip.display, clip.window, XA_PRIMARY,
+                                       XFixesSetSelectionOwnerNotifyMask |
+                                       XFixesSelectionWindowDestroyNotifyMask |
+                                       XFixesSelectionClientCloseNotifyMask);
+            clip.xfixes_event = event_base + XFixesSelectionNotify;
+        }
+    }
+#endif
+    info->info.x11.unlock_func();
+    return(1);
+}
 
 int sdl_ClipboardFilter(const SDL_Event *event)
 {
     Display *display;
+    XEvent *xevent;
 
     /* Post all non-window manager specific events */
     if ( event->type != SDL_SYSWMEVENT ) {
@@ -267,8 +631,9 @@ int sdl_ClipboardFilter(const SDL_Event *event)
     }
 
     /* Handle window-manager specific clipboard events */
-    display = event->syswm.msg->event.xevent.xany.display;
-    switch (event->syswm.msg->event.xevent.type) {
+    xevent = &event->syswm.msg->event.xevent;
+    display = xevent->xany.display;
+    switch (xevent->type) {
         /* Copy the selection from XA_CUT_BUFFER0 to the requested property */
         case SelectionRequest: {
             XSelectionRequestEvent *req;
@@ -278,7 +643,7 @@ int sdl_ClipboardFilter(const SDL_Event *event)
             unsigned long overflow;
             unsigned char *seln_data;
 
-            req = &event->syswm.msg->event.xevent.xselectionrequest;
+            req = &xevent->xselectionrequest;
             sevent.xselection.type = SelectionNotify;
             sevent.xselection.display = req->display;
             sevent.xselection.selection = req->selection;
@@ -306,6 +671,11 @@ int sdl_ClipboardFilter(const SDL_Event *event)
             XSync(display, False);
         }
         break;
+
+        /* Read the selection as its events come in */
+        default:
+            sdl_HandleClipboardEvent(xevent);
+            break;
     }
 
     /* Post the event for X11 clipboard reading above */
@@ -316,13 +686,17 @@ void sdl_InitClipboard(void)
     SDL_SysWMinfo info;
 
     /* See if we can use our X11 code on this driver */
-    SDL_VERSION(&info.version);
-    if ( SDL_GetWMInfo(&info) > 0 ) {
-        if ( info.subsystem == SDL_SYSWM_X11 ) {
-            /* Enable the special window hook events */
-            SDL_EventState(SDL_SYSWMEVENT, SDL_ENABLE);
-            SDL_SetEventFilter(sdl_ClipboardFilter);
+    if ( sdl_SetupClipboard(&info) ) {
+        /* Enable the special window hook events */
+        SDL_EventState(SDL_SYSWMEVENT, SDL_ENABLE);
+        SDL_SetEventFilter(sdl_ClipboardFilter);
+
+        /* Have the text ready for the first sdl_GetClipboard() */
+        info.info.x11.lock_func();
+        if ( ! clip.owned && ! clip.pending ) {
+            sdl_FetchClipboard();
         }
+        info.info.x11.unlock_func();
     }
 }
 
@@ -336,22 +710,19 @@ void sdl_PutClipboard(const char *text)
     strcpy(clipboard, text);
 
     /* Try to put the text selection into the X server */
-    SDL_VERSION(&info.version);
-    if ( SDL_GetWMInfo(&info) > 0 ) {
-        if ( info.subsystem == SDL_SYSWM_X11 ) {
-            Display *display;
-            Window window;
-
-            info.info.x11.lock_func();
-            display = info.info.x11.display;
-            window = info.info.x11.window;
-            XChangeProperty(display, DefaultRootWindow(display),
-                            XA_CUT_BUFFER0, XA_STRING, 8, PropModeReplace,
-                            (unsigned char *)clipboard, strlen(clipboard));
-            if ( XGetSelectionOwner(display, XA_PRIMARY) != window )
-                XSetSelectionOwner(display, XA_PRIMARY, window, CurrentTime);
-            info.info.x11.unlock_func();
+    if ( sdl_SetupClipboard(&info) ) {
+        info.info.x11.lock_func();
+        if ( clip.pending ) {
+            sdl_DropClipboard();
         }
+        XChangeProperty(clip.display, DefaultRootWindow(clip.display),
+                        XA_CUT_BUFFER0, XA_STRING, 8, PropModeReplace,
+                        (unsigned char *)clipboard, strlen(clipboard));
+        if ( XGetSelectionOwner(clip.display, XA_PRIMARY) != clip.window )
+            XSetSelectionOwner(clip.display, XA_PRIMARY, clip.window,
+                                                            CurrentTime);
+        clip.owned = 1;
+        info.info.x11.unlock_func();
     }
 }
 
@@ -360,60 +731,24 @@ const char *sdl_GetClipboard(void)
 {
     SDL_SysWMinfo info;
 
-    /* Try to get a text selection from the X server */
-    SDL_VERSION(&info.version);
-    if ( SDL_GetWMInfo(&info) > 0 ) {
-        if ( info.subsystem == SDL_SYSWM_X11 ) {
-            Display *display;
-            Window window;
-            Window owner;
-            Atom selection;
-            Atom seln_type;
-            int seln_format;
-            unsigned long nbytes;
-            unsigned long overflow;
-            char *src;
-
-            info.info.x11.lock_func();
-            display = info.info.x11.display;
-            window = info.info.x11.window;
-            owner = XGetSelectionOwner(display, XA_PRIMARY);
-            if ( (owner == None) || (owner == window) ) {
-                owner = DefaultRootWindow(display);
-                selection = XA_CUT_BUFFER0;
-            } else {
-                int selection_converted;
-                XEvent xevent;
-
-                owner = window;
-                selection = XInternAtom(display, "SDL_SELECTION", False);
-                XConvertSelection(display, XA_PRIMARY, XA_STRING,
-                                                selection, owner, CurrentTime);
-                selection_converted = 0;
-                while ( ! selection_converted ) {
-                    // FIXME: What mask should we use here?
-                    //XMaskEvent(display, StructureNotifyMask, &xevent);
-                    XNextEvent(display, &xevent);
-                    if ( (xevent.type == SelectionNotify) &&
-                         (xevent.xselection.requestor == owner) ) {
-                        selection_converted = 1;
-                    }
-                }
+    if ( sdl_SetupClipboard(&info) ) {
+        info.info.x11.lock_func();
+        if ( ! sdl_ClipboardFiltered() ) {
+            /* SelectionClear doesn't reach us, so see who owns it */
+            if ( XGetSelectionOwner(clip.display, XA_PRIMARY) != clip.window ) {
+                clip.owned = 0;
+                sdl_ReadClipboardNow();
             }
-            if ( XGetWindowProperty(display, owner, selection, 0,
-                     INT_MAX/4, False, XA_STRING, &seln_type, &seln_format,
-                     &nbytes, &overflow, (unsigned char **)&src) == Success ) {
-                if ( src ) {
-                    if ( seln_type == XA_STRING ) {
-                        clipboard = (char *)realloc(clipboard, nbytes+1);
-                        memcpy(clipboard, src, nbytes);
-                        clipboard[nbytes] = '\0';
-                    }
-                    XFree(src);
-                }
-            }
-            info.info.x11.unlock_func();
+        } else if ( ! clip.owned && ! clip.pending ) {
+            /* Return the text we have, and read it again for next time
+               unless XFixes says it hasn't changed.
+             */
+#ifdef HAVE_XFIXES
+            if ( ! clip.xfixes_event || ! clip.current )
+#endif
+                sdl_FetchClipboard();
         }
+        info.info.x11.unlock_func();
     }
 
     /* Return the clipboard text */
@@ -427,40 +762,373 @@ const char *sdl_GetClipboard(void)
 }
 
 
-int sdl_DisplayImage(const char *filename, SDL_Surface *screen)
+/* The most threads to decode a batch of images with */
+#define MAX_DECODE_THREADS  16
+
+typedef struct {
+    const char **files;
+    sdl_pixels *images;
+    int *status;
+    int count;
+    int next;
+    SDL_mutex *lock;
+} sdl_batch;
+
+/* Decode images from the batch until there are none left.
+   This makes no SDL calls other than locking, so it can run on any thread.
+ */
+static int sdl_DecodeWorker(void *data)
 {
-    SDL_Surface *file = SDL_LoadBMP(filename);
-  
-    if(file){
-        SDL_Rect dst = {0,0, file->w, file->h};
-        
-        dst.x = (screen->w - file->w) / 2;
-        dst.y = (screen->h - file->h) / 2;
+    sdl_batch *batch = (sdl_batch *)data;
+    int i;
 
-        SDL_BlitSurface(file, NULL, screen, &dst);
-        SDL_UpdateRects(screen, 1, &dst);
-        SDL_FreeSurface(file);
-        return 1;
+    for ( ;; ) {
+        if ( batch->lock ) {
+            SDL_mutexP(batch->lock);
+        }
+        i = batch->next++;
+        if ( batch->lock ) {
+            SDL_mutexV(batch->lock);
+        }
+        if ( i >= batch->count ) {
+            break;
+        }
+        batch->status[i] = sdl_DecodePCX_internal(batch->files[i],
+                                                  &batch->images[i]);
+        if ( batch->status[i] > 0 ) {
+            batch->status[i] = sdl_DecodeBMP_internal(batch->files[i],
+                                                      &batch->images[i]);
+        }
     }
-    return 0;
+    return(0);
+}
+
+/* Create a surface from decoded pixels, and free the pixels */
+static SDL_Surface *sdl_PixelsToSurface(sdl_pixels *image)
+{
+    SDL_Surface *surface;
+    Uint8 *src, *dst;
+    int y, len;
+
+    surface = SDL_CreateRGBSurface(SDL_SWSURFACE, image->w, image->h,
+                                   image->bpp, image->Rmask, image->Gmask,
+                                   image->Bmask, image->Amask);
+    if ( surface ) {
+        if ( surface->pitch == image->pitch ) {
+            memcpy(surface->pixels, image->pixels, image->h * image->pitch);
+        } else {
+            src = image->pixels;
+            dst = (Uint8 *)surface->pixels;
+            len = (surface->pitch < image->pitch) ?
+                   surface->pitch : image->pitch;
+            for ( y=0; y<image->h; ++y ) {
+                memcpy(dst, src, len);
+                src += image->pitch;
+                dst += surface->pitch;
+            }
+        }
+        if ( image->ncolors && surface->format->palette ) {
+            SDL_SetColors(surface, image->colors, 0, image->ncolors);
+        }
+    }
+    free(image->pixels);
+    image->pixels = NULL;
+    return(surface);
+}
+
+int sdl_LoadImages(const char *files[], SDL_Surface *surfaces[], int count)
+{
+    SDL_Thread *threads[MAX_DECODE_THREADS];
+    sdl_batch batch;
+    int i, nthreads, loaded;
+
+    if ( count <= 0 ) {
+        return(0);
+    }
+    batch.files = files;
+    batch.count = count;
+    batch.next = 0;
+    batch.images = (sdl_pixels *)calloc(count, sizeof(*batch.images));
+    batch.status = (int *)malloc(count * sizeof(*batch.status));
+    if ( ! batch.images || ! batch.status ) {
+        free(batch.images);
+        free(batch.status);
+        SDL_SetError("Out of memory");
+        return(0);
+    }
+
+    /* The calling thread decodes too, so start one less worker than CPUs */
+    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( nthreads > MAX_DECODE_THREADS ) {
+        nthreads = MAX_DECODE_THREADS;
+    }
+    if ( nthreads > count ) {
+        nthreads = count;
+    }
+    batch.lock = NULL;
+    if ( nthreads > 1 ) {
+        batch.lock = SDL_CreateMutex();
+    }
+    for ( i=0; batch.lock && (i < (nthreads - 1)); ++i ) {
+        threads[i] = SDL_CreateThread(sdl_DecodeWorker, &batch);
+        if ( ! threads[i] ) {
+            break;
+        }
+    }
+    nthreads = i;
+    sdl_DecodeWorker(&batch);
+    for ( i=0; i<nthreads; ++i ) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+    if ( batch.lock ) {
+        SDL_DestroyMutex(batch.lock);
+    }
+
+    /* Create the surfaces, letting SDL load anything we couldn't decode */
+    loaded = 0;
+    for ( i=0; i<count; ++i ) {
+        if ( batch.status[i] == 0 ) {
+            surfaces[i] = sdl_PixelsToSurface(&batch.images[i]);
+        } else if ( batch.status[i] > 0 ) {
+            surfaces[i] = sdl_LoadPCX(files[i]);
+            if ( ! surfaces[i] ) {
+                surfaces[i] = SDL_LoadBMP(files[i]);
+            }
+        } else {
+            SDL_SetError("Error reading %s", files[i]);
+            surfaces[i] = NULL;
+        }
+        if ( surfaces[i] ) {
+            ++loaded;
+        }
+    }
+    free(batch.images);
+    free(batch.status);
+    return(loaded);
+}
+
+/* Images shown with sdl_DisplayImage(), most recently displayed first */
+typedef struct image_cache {
+    char *path;
+    time_t mtime;
+    off_t size;
+    SDL_Surface *surface;
+    unsigned int memory;
+    struct image_cache *prev;
+    struct image_cache *next;
+} image_cache;
+
+static image_cache *image_cache_head = NULL;
+static image_cache *image_cache_tail = NULL;
+static unsigned int image_cache_used = 0;
+static unsigned int image_cache_size = 8*1024*1024;
+
+/* The screen format the cached images were converted to.  On palettized
+   screens the images were mapped to the colors of the palette then.
+ */
+static struct {
+    Uint8 BitsPerPixel;
+    Uint32 Rmask, Gmask, Bmask;
+    int ncolors;
+    SDL_Color colors[256];
+} image_cache_format;
+
+/* See if images converted for the cache would look right on 'format' */
+static int sdl_SameImageFormat(SDL_PixelFormat *format)
+{
+    SDL_Palette *palette;
+    int i;
+
+    if ( (format->BitsPerPixel != image_cache_format.BitsPerPixel) ||
+         (format->Rmask != image_cache_format.Rmask) ||
+         (format->Gmask != image_cache_format.Gmask) ||
+         (format->Bmask != image_cache_format.Bmask) ) {
+        return(0);
+    }
+    palette = format->palette;
+    if ( ! palette ) {
+        return(image_cache_format.ncolors == 0);
+    }
+    if ( palette->ncolors != image_cache_format.ncolors ) {
+        return(0);
+    }
+    for ( i=0; i<palette->ncolors; ++i ) {
+        if ( (palette->colors[i].r != image_cache_format.colors[i].r) ||
+             (palette->colors[i].g != image_cache_format.colors[i].g) ||
+             (palette->colors[i].b != image_cache_format.colors[i].b) ) {
+            return(0);
+        }
+    }
+    return(1);
 }
 
-void sdl_SnapShot(SDL_Surface *screen)
+static void sdl_UnlinkImage(image_cache *entry)
 {
-	char filename[100], path[PATH_MAX];
-	int count = 1;
+    if ( entry->prev ) {
+        entry->prev->next = entry->next;
+    } else {
+        image_cache_head = entry->next;
+    }
+    if ( entry->next ) {
+        entry->next->prev = entry->prev;
+    } else {
+        image_cache_tail = entry->prev;
+    }
+}
 
-	if ( ! screen ) {
-		screen = SDL_GetVideoSurface();
-	}
+static void sdl_LinkImage(image_cache *entry)
+{
+    entry->prev = NULL;
+    entry->next = image_cache_head;
+    if ( image_cache_head ) {
+        image_cache_head->prev = entry;
+    } else {
+        image_cache_tail = entry;
+    }
+    image_cache_head = entry;
+}
 
-	if ( ! screen ) return;
+static void sdl_DropImage(image_cache *entry)
+{
+    sdl_UnlinkImage(entry);
+    image_cache_used -= entry->memory;
+    SDL_FreeSurface(entry->surface);
+    free(entry->path);
+    free(entry);
+}
 
-	do {
-		sprintf(filename,"%s_shot%d.bmp", loki_getgamename(), count++);
-	}while(!access(loki_getpreffile(filename, path, sizeof(path)), R_OK));
+/* Drop the least recently used images until 'needed' more bytes fit */
+static void sdl_TrimImageCache(unsigned int needed)
+{
+    while ( image_cache_tail &&
+            ((image_cache_used + needed) > image_cache_size) ) {
+        sdl_DropImage(image_cache_tail);
+    }
+}
 
-	SDL_SaveBMP(screen, path);
+void sdl_FlushImageCache(void)
+{
+    while ( image_cache_head ) {
+        sdl_DropImage(image_cache_head);
+    }
+}
+
+void sdl_SetImageCacheSize(unsigned int bytes)
+{
+    image_cache_size = bytes;
+    sdl_TrimImageCache(0);
+}
+
+/* Load an image converted to the format of 'screen', using the cache if
+   possible.  'cached' is set if the cache owns the returned surface.
+ */
+static SDL_Surface *sdl_LoadDisplayImage(const char *filename,
+                                         SDL_Surface *screen, int *cached)
+{
+    SDL_PixelFormat *format;
+    SDL_Surface *file, *image;
+    image_cache *entry;
+    struct stat sb;
+
+    *cached = 0;
+    if ( stat(filename, &sb) < 0 ) {
+        SDL_SetError("Couldn't open %s", filename);
+        return(NULL);
+    }
+
+    /* Everything has to be converted again if the screen format or
+       palette changed
+     */
+    format = screen->format;
+    if ( ! sdl_SameImageFormat(format) ) {
+        sdl_FlushImageCache();
+        image_cache_format.BitsPerPixel = format->BitsPerPixel;
+        image_cache_format.Rmask = format->Rmask;
+        image_cache_format.Gmask = format->Gmask;
+        image_cache_format.Bmask = format->Bmask;
+        image_cache_format.ncolors = 0;
+        if ( format->palette && (format->palette->ncolors <= 256) ) {
+            image_cache_format.ncolors = format->palette->ncolors;
+            memcpy(image_cache_format.colors, format->palette->colors,
+                   image_cache_format.ncolors * sizeof(SDL_Color));
+        }
+    }
+
+    for ( entry = image_cache_head; entry; entry = entry->next ) {
+        if ( strcmp(entry->path, filename) == 0 ) {
+            if ( (entry->mtime == sb.st_mtime) && (entry->size == sb.st_size) ) {
+                /* Move it to the front of the list */
+                sdl_UnlinkImage(entry);
+                sdl_LinkImage(entry);
+                *cached = 1;
+                return(entry->surface);
+            }
+            /* The file has changed since it was loaded */
+            sdl_DropImage(entry);
+            break;
+        }
+    }
+
+    file = SDL_LoadBMP(filename);
+    if ( ! file ) {
+        return(NULL);
+    }
+    if ( screen == SDL_GetVideoSurface() ) {
+        image = SDL_DisplayFormat(file);
+    } else {
+        image = SDL_ConvertSurface(file, screen->format, SDL_SWSURFACE);
+    }
+    if ( image ) {
+        SDL_FreeSurface(file);
+    } else {
+        image = file;
+    }
+
+    /* Keep it around if it fits in the cache */
+    entry = (image_cache *)malloc(sizeof(*entry));
+    if ( entry ) {
+        entry->memory = sizeof(*image) + image->h * image->pitch;
+        entry->path = strdup(filename);
+    }
+    if ( ! entry || ! entry->path || (entry->memory > image_cache_size) ) {
+        if ( entry ) {
+            free(entry->path);
+            free(entry);
+        }
+        return(image);
+    }
+    sdl_TrimImageCache(entry->memory);
+    entry->mtime = sb.st_mtime;
+    entry->size = sb.st_size;
+    entry->surface = image;
+    sdl_LinkImage(entry);
+    image_cache_used += entry->memory;
+    *cached = 1;
+    return(image);
+}
+
+int sdl_DisplayImage(const char *filename, SDL_Surface *screen)
+{
+    SDL_Surface *image;
+    int cached;
+
+    image = sdl_LoadDisplayImage(filename, screen, &cached);
+    if(image){
+        SDL_Rect dst;
+
+        dst.x = (screen->w - image->w) / 2;
+        dst.y = (screen->h - image->h) / 2;
+        dst.w = image->w;
+        dst.h = image->h;
+
+        SDL_BlitSurface(image, NULL, screen, &dst);
+        SDL_UpdateRects(screen, 1, &dst);
+        if ( ! cached ) {
+            SDL_FreeSurface(image);
+        }
+        return 1;
+    }
+    return 0;
 }
 
 /*********************************************************************/
@@ -14,6 +14,20 @@ extern int sdl_GetWindowSize(int *width, int *height);
 extern int sdl_GetWindowPosition(int *x, int *y);
 extern void sdl_GetAbsoluteMouseCoords(int *x, int *y);
 extern void sdl_ToggleConfineMouse(void);
+
+/* sdl_InitClipboard() makes sdl_ClipboardFilter() the SDL event filter
+   and enables SDL_SYSWMEVENT events.  While both are still so, the filter
+   reads the X11 selection as it changes, and sdl_GetClipboard() returns
+   the last text read without waiting for the X server.  If the program
+   sets another event filter or disables SDL_SYSWMEVENT, sdl_GetClipboard()
+   still works, but waits for the selection owner to send the text.
+
+   Unless the library is built with XFIXES=true and the X server has the
+   XFixes extension, the filter isn't told when another program takes the
+   selection.  Each sdl_GetClipboard() then reads the selection again for
+   the next call, so the first call after another program copies text
+   still returns the text copied before it.
+ */
 extern void sdl_InitClipboard(void);
 extern void sdl_PutClipboard(const char *text);
 extern int sdl_ClipboardFilter(const SDL_Event *event);
@@ -22,14 +36,62 @@ extern const char *sdl_GetClipboard(void);
 /* Load a PCX file in a SDL surface */
 extern SDL_Surface *sdl_LoadPCX(const char *filename);
 
+/* Load a batch of PCX and BMP images, decoding them in parallel.
+   Each entry in 'surfaces' is set to the image loaded from the file at
+   the same index in 'files', or NULL if it couldn't be loaded.  The
+   surfaces themselves are created on the calling thread.
+   Returns the number of images loaded.
+ */
+extern int sdl_LoadImages(const char *files[], SDL_Surface *surfaces[],
+                          int count);
+
 /* Display a BMP image */
 extern int sdl_DisplayImage(const char *filename, SDL_Surface *screen);
 
+/* Set the amount of memory used to keep images displayed with
+   sdl_DisplayImage() ready to be shown again, converted to the screen
+   format.  The least recently displayed images are dropped first.
+   The default is 8 MB, and 0 disables the cache.
+ */
+extern void sdl_SetImageCacheSize(unsigned int bytes);
+
+/* Free all the images kept by sdl_DisplayImage() */
+extern void sdl_FlushImageCache(void);
+
 /* Save a snapshot of the screen in the user's game directory.
    If 'screen' is NULL, then the main SDL screen surface is used.
  */
 extern void sdl_SnapShot(SDL_Surface *screen);
 
+/* Snapshots are written to disk in the background, this waits until
+   all the snapshots taken so far have been written.
+ */
+extern void sdl_FlushSnapShots(void);
+
+/* Record a sequence of frames into a single file, for example to look
+   at a performance problem frame by frame.  If 'filename' is NULL, the
+   file is put in the user's game directory, and if 'screen' is NULL the
+   main SDL screen surface is used.  'buffers' is the number of frames
+   that can be waiting to be written, 0 picks a default.
+   Returns 0, or -1 if the capture couldn't be started.
+ */
+extern int sdl_StartCapture(const char *filename, SDL_Surface *screen,
+                            int buffers);
+
+/* Copy a frame into the capture, call this after each screen update.
+   The frame is dropped if the disk has fallen behind.
+ */
+extern void sdl_CaptureFrame(SDL_Surface *screen);
+
+/* Return the number of frames dropped so far in this capture */
+extern int sdl_CaptureDropped(void);
+
+/* Finish writing the capture file.
+   Returns the number of frames dropped, or -1 if the file couldn't be
+   written.
+ */
+extern int sdl_StopCapture(void);
+
 void sdl_ShowMessage(const char *fmt, ...);
 
 